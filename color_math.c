@@ -1,11 +1,15 @@
 #define _POSIX_C_SOURCE 200809L
 #include <math.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include "color_math.h"
 
-static double SOLAR_START_TWILIGHT = RADIANS(90.833 + 6.0);
-static double SOLAR_END_TWILIGHT   = RADIANS(90.833 - 3.0);
+// Cosines of the zenith angle of the sun at dawn and dusk, 90.833 + 6.0
+// degrees, and at sunrise and sunset, 90.833 - 3.0 degrees
+static const double COS_SOLAR_START_TWILIGHT = -0.1189758557125856;
+static const double COS_SOLAR_END_TWILIGHT   = 0.03781226862869094;
 
 static int days_in_year(int year) {
 	int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
@@ -36,11 +40,57 @@ static double sun_declination(double orbit_angle) {
 		0.00148 * sin(3*orbit_angle);
 }
 
-static double sun_hour_angle(double latitude, double declination, double target_sun) {
+/*
+ * The precise model evaluates the full NOAA solar position algorithm, based
+ * on Meeus' Astronomical Algorithms, at the time of each event rather than
+ * once per date. This accounts for the movement of the sun during the day and
+ * the drift of the orbit over the years, which matter most at high latitudes
+ * where the sun crosses the horizon at a shallow angle.
+ */
+static double julian_day(const struct tm *tm) {
+	// Days since 1970-01-01 in the proleptic Gregorian calendar
+	long year = tm->tm_year + 1900 - 1;
+	long days = year * 365 + year / 4 - year / 100 + year / 400 - 719162 +
+		tm->tm_yday;
+	double seconds = tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+	return 2440587.5 + days + seconds / 86400.0;
+}
+
+static void sun_position(double julian_day, double *declination,
+		double *eqtime) {
+	// https://gml.noaa.gov/grad/solcalc/calcdetails.html
+	double t = (julian_day - 2451545.0) / 36525.0;
+	double mean_long = RADIANS(fmod(280.46646 +
+		t * (36000.76983 + t * 0.0003032), 360.0));
+	double mean_anomaly = RADIANS(357.52911 +
+		t * (35999.05029 - 0.0001537 * t));
+	double eccentricity = 0.016708634 - t * (0.000042037 + 0.0000001267 * t);
+	double center = RADIANS(
+		sin(mean_anomaly) * (1.914602 - t * (0.004817 + 0.000014 * t)) +
+		sin(2 * mean_anomaly) * (0.019993 - 0.000101 * t) +
+		sin(3 * mean_anomaly) * 0.000289);
+	double omega = RADIANS(125.04 - 1934.136 * t);
+	double apparent_long = mean_long + center -
+		RADIANS(0.00569 + 0.00478 * sin(omega));
+	double obliquity = RADIANS(23.0 + (26.0 + (21.448 -
+		t * (46.815 + t * (0.00059 - t * 0.001813))) / 60.0) / 60.0 +
+		0.00256 * cos(omega));
+	double y = pow(tan(obliquity / 2), 2);
+
+	*declination = asin(sin(obliquity) * sin(apparent_long));
+	*eqtime = 4 * (y * sin(2 * mean_long) -
+		2 * eccentricity * sin(mean_anomaly) +
+		4 * eccentricity * y * sin(mean_anomaly) * cos(2 * mean_long) -
+		0.5 * y * y * sin(4 * mean_long) -
+		1.25 * eccentricity * eccentricity * sin(2 * mean_anomaly));
+}
+
+static double sun_hour_angle(const struct sun_day *day,
+		const struct sun_site *site, double cos_target_sun) {
 	// https://www.esrl.noaa.gov/gmd/grad/solcalc/solareqns.PDF
-	return acos(cos(target_sun) /
-		cos(latitude) * cos(declination) -
-		tan(latitude) * tan(declination));
+	return acos(cos_target_sun /
+		site->cos_latitude * day->cos_declination -
+		site->tan_latitude * day->tan_declination);
 }
 
 static time_t hour_angle_to_time(double hour_angle, double eqtime) {
@@ -54,21 +104,143 @@ static enum sun_condition condition(double latitude_rad, double sun_declination)
 	return sign_lat == sign_decl ? MIDNIGHT_SUN : POLAR_NIGHT;
 }
 
-enum sun_condition calc_sun(struct tm *tm, double latitude, struct sun *sun) {
-	double orbit_angle = date_orbit_angle(tm);
-	double decl = sun_declination(orbit_angle);
-	double eqtime = equation_of_time(orbit_angle);
+/*
+ * Returns the time of an event of the precise model in seconds since the
+ * start of the day, refining it by evaluating the position of the sun at the
+ * previous estimate, or NAN if the sun does not reach the target.
+ */
+static double precise_event_time(const struct sun_day *day,
+		const struct sun_site *site, double cos_target_sun, bool rising) {
+	double declination = day->declination;
+	double eqtime = day->eqtime;
+	double time = NAN;
+	for (int i = 0; i < 3; i++) {
+		// https://gml.noaa.gov/grad/solcalc/calcdetails.html
+		double hour_angle = acos(cos_target_sun /
+			(site->cos_latitude * cos(declination)) -
+			site->tan_latitude * tan(declination));
+		if (isnan(hour_angle)) {
+			return NAN;
+		}
+		if (!rising) {
+			hour_angle = -hour_angle;
+		}
+		time = DEGREES((4.0 * M_PI - 4 * hour_angle - eqtime) * 60);
+		sun_position(day->julian_day + time / 86400.0, &declination,
+				&eqtime);
+	}
+	return time;
+}
+
+static enum sun_condition calc_sun_precise(const struct sun_day *day,
+		const struct sun_site *site, struct sun *sun) {
+	double dawn = precise_event_time(day, site, COS_SOLAR_START_TWILIGHT, true);
+	double sunrise = precise_event_time(day, site, COS_SOLAR_END_TWILIGHT, true);
+	double sunset = precise_event_time(day, site, COS_SOLAR_END_TWILIGHT, false);
+	double dusk = precise_event_time(day, site, COS_SOLAR_START_TWILIGHT, false);
+	if (isnan(dawn) || isnan(sunrise) || isnan(sunset) || isnan(dusk)) {
+		return condition(site->latitude, day->declination);
+	}
+
+	sun->dawn = lround(dawn);
+	sun->sunrise = lround(sunrise);
+	sun->sunset = lround(sunset);
+	sun->dusk = lround(dusk);
+	return NORMAL;
+}
+
+void calc_sun_day(struct tm *tm, enum sun_model model, struct sun_day *day) {
+	day->model = model;
+	day->julian_day = julian_day(tm);
+	if (model == SUN_MODEL_PRECISE) {
+		// The position at noon is the first estimate for all events
+		sun_position(day->julian_day + 0.5, &day->declination,
+				&day->eqtime);
+	} else {
+		double orbit_angle = date_orbit_angle(tm);
+		day->declination = sun_declination(orbit_angle);
+		day->eqtime = equation_of_time(orbit_angle);
+	}
+	day->cos_declination = cos(day->declination);
+	day->tan_declination = tan(day->declination);
+}
+
+void calc_sun_site(double latitude, struct sun_site *site) {
+	site->latitude = latitude;
+	site->sin_latitude = sin(latitude);
+	site->cos_latitude = cos(latitude);
+	site->tan_latitude = tan(latitude);
+}
+
+enum sun_condition calc_sun_at(const struct sun_day *day,
+		const struct sun_site *site, struct sun *sun) {
+	if (day->model == SUN_MODEL_PRECISE) {
+		return calc_sun_precise(day, site, sun);
+	}
 
-	double ha_twilight = sun_hour_angle(latitude, decl, SOLAR_START_TWILIGHT);
-	double ha_daylight = sun_hour_angle(latitude, decl, SOLAR_END_TWILIGHT);
+	double ha_twilight = sun_hour_angle(day, site, COS_SOLAR_START_TWILIGHT);
+	double ha_daylight = sun_hour_angle(day, site, COS_SOLAR_END_TWILIGHT);
 
-	sun->dawn = hour_angle_to_time(fabs(ha_twilight), eqtime);
-	sun->dusk = hour_angle_to_time(-fabs(ha_twilight), eqtime);
-	sun->sunrise = hour_angle_to_time(fabs(ha_daylight), eqtime);
-	sun->sunset = hour_angle_to_time(-fabs(ha_daylight), eqtime);
+	sun->dawn = hour_angle_to_time(fabs(ha_twilight), day->eqtime);
+	sun->dusk = hour_angle_to_time(-fabs(ha_twilight), day->eqtime);
+	sun->sunrise = hour_angle_to_time(fabs(ha_daylight), day->eqtime);
+	sun->sunset = hour_angle_to_time(-fabs(ha_daylight), day->eqtime);
 
 	return isnan(ha_twilight) || isnan(ha_daylight) ?
-		condition(latitude, decl) : NORMAL;
+		condition(site->latitude, day->declination) : NORMAL;
+}
+
+static double sun_elevation_sine(const struct sun_day *day,
+		const struct sun_site *site, double time) {
+	double declination = day->declination;
+	double eqtime = day->eqtime;
+	if (day->model == SUN_MODEL_PRECISE) {
+		sun_position(day->julian_day + time / 86400.0, &declination,
+				&eqtime);
+	}
+
+	// https://gml.noaa.gov/grad/solcalc/calcdetails.html
+	double hour_angle = M_PI * time / 43200.0 + eqtime / 4.0 - M_PI;
+	return site->sin_latitude * sin(declination) +
+		site->cos_latitude * cos(declination) * cos(hour_angle);
+}
+
+/*
+ * The sine of the elevation of the sun over a day is fitted with a Chebyshev
+ * series, sampled at the Chebyshev nodes of the day. The sine is a smooth
+ * curve, close to a single cosine, so 12 terms keep it within 1e-6 of the
+ * model, and each evaluation is a handful of multiply-adds rather than a round
+ * of trig. Between dawn and sunrise, where the schedule uses it, that is
+ * within 0.0001 degrees of elevation. With the sun almost overhead, where the
+ * sine is flat, the elevation itself can be off by up to 0.07 degrees.
+ */
+void fit_sun_elevation(const struct sun_day *day, const struct sun_site *site,
+		struct sun_elevation_fit *fit) {
+	const int n = SUN_ELEVATION_FIT_TERMS;
+	double samples[SUN_ELEVATION_FIT_TERMS];
+	for (int k = 0; k < n; k++) {
+		double x = cos(M_PI * (k + 0.5) / n);
+		samples[k] = sun_elevation_sine(day, site, (x + 1.0) * 43200.0);
+	}
+	for (int j = 0; j < n; j++) {
+		double sum = 0.0;
+		for (int k = 0; k < n; k++) {
+			sum += samples[k] * cos(M_PI * j * (k + 0.5) / n);
+		}
+		fit->coeffs[j] = 2.0 * sum / n;
+	}
+}
+
+double eval_sun_elevation(const struct sun_elevation_fit *fit, double time) {
+	// Clenshaw recurrence
+	double x = time / 43200.0 - 1.0;
+	double b1 = 0.0, b2 = 0.0;
+	for (int j = SUN_ELEVATION_FIT_TERMS - 1; j > 0; j--) {
+		double b0 = 2.0 * x * b1 - b2 + fit->coeffs[j];
+		b2 = b1;
+		b1 = b0;
+	}
+	return x * b1 - b2 + fit->coeffs[0] / 2.0;
 }
 
 /*
@@ -79,7 +251,7 @@ enum sun_condition calc_sun(struct tm *tm, double latitude, struct sun *sun) {
  * This approximation is strictly speaking only well-defined between 4000K and
  * 25000K, but we stretch it a bit further down for transition purposes.
  */
-static int illuminant_d(int temp, double *x, double *y) {
+static int illuminant_d(double temp, double *x, double *y) {
 	// https://en.wikipedia.org/wiki/Standard_illuminant#Illuminant_series_D
 	if (temp >= 2500 && temp <= 7000) {
 		*x = 0.244063 +
@@ -106,7 +278,7 @@ static int illuminant_d(int temp, double *x, double *y) {
  *
  * This approximation is only valid from 1667K to 25000K.
  */
-static int planckian_locus(int temp, double *x, double *y) {
+static int planckian_locus(double temp, double *x, double *y) {
 	// https://en.wikipedia.org/wiki/Planckian_locus#Approximation
 	if (temp >= 1667 && temp <= 4000) {
 		*x = -0.2661239e9 / pow(temp, 3) -
@@ -142,8 +314,14 @@ static int planckian_locus(int temp, double *x, double *y) {
 
 static double srgb_gamma(double value, double gamma) {
 	// https://en.wikipedia.org/wiki/SRGB
-	if (value <= 0.0031308) {
-		return 12.92 * value;
+	//
+	// The linear segment is scaled to meet the power segment at the
+	// threshold. The two do not otherwise meet for gamma 2.2, which made the
+	// blue channel of the whitepoint drop abruptly around 1940K.
+	const double threshold = 0.0031308;
+	if (value <= threshold) {
+		return value / threshold *
+			(pow(1.055 * threshold, 1.0/gamma) - 0.055);
 	} else {
 		return pow(1.055 * value, 1.0/gamma) - 0.055;
 	}
@@ -173,12 +351,7 @@ static void srgb_normalize(double *r, double *g, double *b) {
 	*b /= maxw;
 }
 
-void calc_whitepoint(int temp, double *rw, double *gw, double *bw) {
-	if (temp == 6500) {
-		*rw = *gw = *bw = 1.0;
-		return;
-	}
-
+static void calc_whitepoint_raw(double temp, double *rw, double *gw, double *bw) {
 	double x = 1.0, y = 1.0;
 	if (temp >= 25000) {
 		illuminant_d(25000, &x, &y);
@@ -189,7 +362,7 @@ void calc_whitepoint(int temp, double *rw, double *gw, double *bw) {
 		illuminant_d(temp, &x1, &y1);
 		planckian_locus(temp, &x2, &y2);
 
-		double factor = (4000 - temp) / 1500;
+		double factor = (4000 - temp) / 1500.0;
 		double sinefactor = (cos(M_PI*factor) + 1.0) / 2.0;
 		x = x1 * sinefactor + x2 * (1.0 - sinefactor);
 		y = y1 * sinefactor + y2 * (1.0 - sinefactor);
@@ -201,6 +374,102 @@ void calc_whitepoint(int temp, double *rw, double *gw, double *bw) {
 	double z = 1.0 - x - y;
 
 	xyz_to_srgb(x, y, z, rw, gw, bw);
+}
+
+/*
+ * The whitepoint is expressed relative to that of 6500K, so that D65 maps to
+ * exactly 1.0 on all channels without a discontinuity around it.
+ */
+static void calc_whitepoint_exact(double temp, double *rw, double *gw, double *bw) {
+	double r65, g65, b65;
+	calc_whitepoint_raw(6500, &r65, &g65, &b65);
+	calc_whitepoint_raw(temp, rw, gw, bw);
+	*rw /= r65;
+	*gw /= g65;
+	*bw /= b65;
 	srgb_normalize(rw, gw, bw);
 }
 
+/*
+ * The whitepoint curve is sampled every WHITEPOINT_STEP kelvin on first use,
+ * and linearly interpolated in between. This stays within 0.1% of
+ * calc_whitepoint_exact, while each evaluation becomes two loads and a lerp
+ * per channel, and fractional temperatures cost no more than whole ones.
+ */
+#define WHITEPOINT_MIN_TEMP 1000
+#define WHITEPOINT_MAX_TEMP 25000
+#define WHITEPOINT_STEP 5
+#define WHITEPOINT_ENTRIES \
+	((WHITEPOINT_MAX_TEMP - WHITEPOINT_MIN_TEMP) / WHITEPOINT_STEP + 1)
+
+static float whitepoint_table[WHITEPOINT_ENTRIES][3];
+static bool whitepoint_table_ready = false;
+
+static void init_whitepoint_table(void) {
+	for (int i = 0; i < WHITEPOINT_ENTRIES; i++) {
+		double rw, gw, bw;
+		calc_whitepoint_exact(WHITEPOINT_MIN_TEMP + i * WHITEPOINT_STEP,
+				&rw, &gw, &bw);
+		whitepoint_table[i][0] = rw;
+		whitepoint_table[i][1] = gw;
+		whitepoint_table[i][2] = bw;
+	}
+	whitepoint_table_ready = true;
+}
+
+void calc_whitepoint(double temp, double *rw, double *gw, double *bw) {
+	if (!whitepoint_table_ready) {
+		init_whitepoint_table();
+	}
+
+	int idx;
+	double factor;
+	if (!(temp > WHITEPOINT_MIN_TEMP)) {
+		idx = 0;
+		factor = 0.0;
+	} else if (temp >= WHITEPOINT_MAX_TEMP) {
+		idx = WHITEPOINT_ENTRIES - 1;
+		factor = 0.0;
+	} else {
+		double pos = (temp - WHITEPOINT_MIN_TEMP) / WHITEPOINT_STEP;
+		idx = (int)pos;
+		factor = pos - idx;
+	}
+
+	const float *lo = whitepoint_table[idx];
+	const float *hi = factor > 0.0 ? whitepoint_table[idx + 1] : lo;
+	*rw = lo[0] + (hi[0] - lo[0]) * factor;
+	*gw = lo[1] + (hi[1] - lo[1]) * factor;
+	*bw = lo[2] + (hi[2] - lo[2]) * factor;
+}
+
+void fill_gamma_table(uint16_t *table, uint32_t ramp_size, double rw,
+		double gw, double bw, double gamma) {
+	uint16_t *r = table;
+	uint16_t *g = table + ramp_size;
+	uint16_t *b = table + 2 * ramp_size;
+
+	// pow(val * w, 1/gamma) == pow(val, 1/gamma) * pow(w, 1/gamma), so the
+	// whitepoint is factored out of the loop and each entry costs one pow()
+	// shared by all three channels. Rounding may differ from evaluating the
+	// whole expression by one step. At gamma 1.0 there is no pow() at all,
+	// and entries are computed exactly as before.
+	double exponent = 1.0 / gamma;
+	double rs = UINT16_MAX * pow(rw, exponent);
+	double gs = UINT16_MAX * pow(gw, exponent);
+	double bs = UINT16_MAX * pow(bw, exponent);
+	bool linear = gamma == 1.0;
+	for (uint32_t i = 0; i < ramp_size; ++i) {
+		double val = (double)i / (ramp_size - 1);
+		if (linear) {
+			r[i] = (uint16_t)(UINT16_MAX * (val * rw));
+			g[i] = (uint16_t)(UINT16_MAX * (val * gw));
+			b[i] = (uint16_t)(UINT16_MAX * (val * bw));
+		} else {
+			val = pow(val, exponent);
+			r[i] = (uint16_t)(rs * val);
+			g[i] = (uint16_t)(gs * val);
+			b[i] = (uint16_t)(bs * val);
+		}
+	}
+}
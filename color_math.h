@@ -2,6 +2,7 @@
 #define _COLOR_MATH_H
 
 #include "math.h"
+#include "stdint.h"
 #include "time.h"
 
 // These are macros so they can be applied to constants
@@ -22,7 +23,61 @@ struct sun {
 	time_t dusk;
 };
 
-enum sun_condition calc_sun(struct tm *tm, double latitude, struct sun *sun);
-void calc_whitepoint(int temp, double *rw, double *gw, double *bw);
+/*
+ * The fast model evaluates a low order series once per date. The precise model
+ * evaluates the full NOAA algorithm at the time of each event, which is more
+ * accurate by up to several minutes at high latitudes.
+ */
+enum sun_model {
+	SUN_MODEL_FAST,
+	SUN_MODEL_PRECISE,
+};
+
+/*
+ * The terms of the sun calculation that only depend on the day or on the
+ * latitude, so that many days and sites can be combined without recomputing
+ * them.
+ */
+struct sun_day {
+	enum sun_model model;
+	double julian_day;
+	double declination;
+	double eqtime;
+	double cos_declination;
+	double tan_declination;
+};
+
+struct sun_site {
+	double latitude;
+	double sin_latitude;
+	double cos_latitude;
+	double tan_latitude;
+};
+
+void calc_sun_day(struct tm *tm, enum sun_model model, struct sun_day *day);
+void calc_sun_site(double latitude, struct sun_site *site);
+enum sun_condition calc_sun_at(const struct sun_day *day,
+		const struct sun_site *site, struct sun *sun);
+
+// Sine of the elevation of the sun at dawn or dusk, and at sunrise or sunset
+#define SUN_ELEVATION_TWILIGHT sin(RADIANS(90.0 - (90.833 + 6.0)))
+#define SUN_ELEVATION_DAYLIGHT sin(RADIANS(90.0 - (90.833 - 3.0)))
+
+#define SUN_ELEVATION_FIT_TERMS 12
+
+struct sun_elevation_fit {
+	double coeffs[SUN_ELEVATION_FIT_TERMS];
+};
+
+/*
+ * Fits the sine of the elevation of the sun over the day, and evaluates it at
+ * a time in seconds since the start of the day.
+ */
+void fit_sun_elevation(const struct sun_day *day, const struct sun_site *site,
+		struct sun_elevation_fit *fit);
+double eval_sun_elevation(const struct sun_elevation_fit *fit, double time);
+void calc_whitepoint(double temp, double *rw, double *gw, double *bw);
+void fill_gamma_table(uint16_t *table, uint32_t ramp_size, double rw,
+		double gw, double bw, double gamma);
 
 #endif
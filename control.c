@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+
+/*
+ * A unix socket taking one command line per connection. The reply is written
+ * back in full and the connection closed, so that any client that can send a
+ * line and read until EOF can talk to it.
+ */
+struct control_client {
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE_MAX];
+};
+
+struct control {
+	int fd;
+	struct sockaddr_un addr;
+	struct control_client clients[CONTROL_MAX_CLIENTS];
+};
+
+int control_socket_path(char *path, size_t size) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+		return -1;
+	}
+
+	// WAYLAND_DISPLAY may also be an absolute path to the socket
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (display == NULL) {
+		display = "wayland-0";
+	} else if (strrchr(display, '/') != NULL) {
+		display = strrchr(display, '/') + 1;
+	}
+
+	int len = snprintf(path, size, "%s/wlsunset-%s.sock", dir, display);
+	if (len < 0 || (size_t)len >= size) {
+		fprintf(stderr, "control socket path is too long\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int set_address(struct sockaddr_un *addr, const char *path) {
+	*addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof addr->sun_path) {
+		fprintf(stderr, "control socket path is too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+static bool socket_is_alive(const struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		return false;
+	}
+	bool alive = connect(fd, (const struct sockaddr *)addr,
+			sizeof *addr) == 0;
+	close(fd);
+	return alive;
+}
+
+struct control *control_create(const char *path) {
+	struct control *control = calloc(1, sizeof *control);
+	if (control == NULL) {
+		fprintf(stderr, "could not allocate control socket\n");
+		return NULL;
+	}
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		control->clients[i].fd = -1;
+	}
+	if (set_address(&control->addr, path) == -1) {
+		free(control);
+		return NULL;
+	}
+
+	control->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (control->fd == -1) {
+		fprintf(stderr, "could not create control socket: %s\n",
+				strerror(errno));
+		free(control);
+		return NULL;
+	}
+
+	const struct sockaddr *addr = (const struct sockaddr *)&control->addr;
+	int ret = bind(control->fd, addr, sizeof control->addr);
+	if (ret == -1 && errno == EADDRINUSE) {
+		// Possibly left behind by an instance that did not exit cleanly
+		if (socket_is_alive(&control->addr)) {
+			fprintf(stderr, "another instance is listening on %s\n",
+					path);
+			goto error;
+		}
+		unlink(path);
+		ret = bind(control->fd, addr, sizeof control->addr);
+	}
+	if (ret == -1 || listen(control->fd, CONTROL_MAX_CLIENTS) == -1) {
+		fprintf(stderr, "could not listen on %s: %s\n", path,
+				strerror(errno));
+		goto error;
+	}
+	return control;
+
+error:
+	close(control->fd);
+	free(control);
+	return NULL;
+}
+
+static void close_client(struct control_client *client) {
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+}
+
+void control_destroy(struct control *control) {
+	if (control == NULL) {
+		return;
+	}
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (control->clients[i].fd != -1) {
+			close_client(&control->clients[i]);
+		}
+	}
+	close(control->fd);
+	unlink(control->addr.sun_path);
+	free(control);
+}
+
+void control_fill_pollfds(struct control *control, struct pollfd *pfd) {
+	// Negative fds are ignored by poll, which covers unused client slots
+	// and a missing control socket alike.
+	pfd[0] = (struct pollfd){
+		.fd = control != NULL ? control->fd : -1,
+		.events = POLLIN,
+	};
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		pfd[i + 1] = (struct pollfd){
+			.fd = control != NULL ? control->clients[i].fd : -1,
+			.events = POLLIN,
+		};
+	}
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			// Replies fit the socket buffer, so this is a client
+			// that went away.
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+static void reply_client(struct control_client *client,
+		control_handler handler, void *data) {
+	char *reply = NULL;
+	size_t reply_len = 0;
+	FILE *f = open_memstream(&reply, &reply_len);
+	if (f == NULL) {
+		close_client(client);
+		return;
+	}
+	handler(data, client->buf, f);
+	fclose(f);
+
+	write_all(client->fd, reply, reply_len);
+	free(reply);
+	close_client(client);
+}
+
+static void read_client(struct control_client *client,
+		control_handler handler, void *data) {
+	size_t space = sizeof client->buf - client->len - 1;
+	ssize_t n = read(client->fd, client->buf + client->len, space);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	} else if (n == -1 || (n == 0 && client->len == 0)) {
+		close_client(client);
+		return;
+	}
+	client->len += n;
+	client->buf[client->len] = '\0';
+
+	// A command is terminated by a newline, or by the end of the stream
+	char *end = strchr(client->buf, '\n');
+	if (end == NULL && n > 0) {
+		if (client->len == sizeof client->buf - 1) {
+			write_all(client->fd, "error: line too long\n", 21);
+			close_client(client);
+		}
+		return;
+	}
+	if (end != NULL) {
+		*end = '\0';
+	}
+	if (end != NULL && end > client->buf && end[-1] == '\r') {
+		end[-1] = '\0';
+	}
+	reply_client(client, handler, data);
+}
+
+static void accept_client(struct control *control) {
+	int fd = accept4(control->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) {
+		return;
+	}
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (control->clients[i].fd == -1) {
+			control->clients[i].fd = fd;
+			return;
+		}
+	}
+	write_all(fd, "error: too many clients\n", 24);
+	close(fd);
+}
+
+void control_dispatch(struct control *control, struct pollfd *pfd,
+		control_handler handler, void *data) {
+	if (control == NULL) {
+		return;
+	}
+	for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (pfd[i + 1].revents != 0 && control->clients[i].fd != -1) {
+			read_client(&control->clients[i], handler, data);
+		}
+	}
+	if (pfd[0].revents & POLLIN) {
+		accept_client(control);
+	}
+}
+
+/*
+ * Sends a command to a running instance and copies its reply to stdout.
+ * Returns 1 if the command was rejected.
+ */
+int control_request(const char *path, const char *command) {
+	struct sockaddr_un addr;
+	if (set_address(&addr, path) == -1) {
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		fprintf(stderr, "could not create socket: %s\n", strerror(errno));
+		return -1;
+	}
+	if (connect(fd, (const struct sockaddr *)&addr, sizeof addr) == -1) {
+		fprintf(stderr, "could not connect to %s: %s\n", path,
+				strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	write_all(fd, command, strlen(command));
+	write_all(fd, "\n", 1);
+	shutdown(fd, SHUT_WR);
+
+	char buf[4096];
+	bool first = true, rejected = false;
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof buf)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "could not read reply: %s\n",
+					strerror(errno));
+			close(fd);
+			return -1;
+		}
+		if (first) {
+			rejected = strncmp(buf, "error", n < 5 ? n : 5) == 0;
+			first = false;
+		}
+		fwrite(buf, 1, n, stdout);
+	}
+	close(fd);
+	return rejected ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_LINE_MAX 256
+
+// Number of pollfds used by a control socket and its clients
+#define CONTROL_POLLFDS (1 + CONTROL_MAX_CLIENTS)
+
+/*
+ * Called with every command line received, with the reply to be written to
+ * reply. The client is disconnected once the reply has been sent.
+ */
+typedef void (*control_handler)(void *data, char *line, FILE *reply);
+
+struct control;
+
+int control_socket_path(char *path, size_t size);
+struct control *control_create(const char *path);
+void control_destroy(struct control *control);
+void control_fill_pollfds(struct control *control, struct pollfd *pfd);
+void control_dispatch(struct control *control, struct pollfd *pfd,
+		control_handler handler, void *data);
+int control_request(const char *path, const char *command);
+
+#endif
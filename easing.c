@@ -0,0 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "easing.h"
+
+/*
+ * Reads a curve as one "time progress" pair per line, both from 0 to 1, with
+ * both increasing. Empty lines and lines starting with # are skipped. The
+ * curve is linear between points, and is anchored at 0 0 and 1 1 unless the
+ * file says otherwise.
+ *
+ * A flat segment would hold a progress that the schedule, which steps from
+ * temperature to temperature, never lands on. Only the ends, where the curve
+ * rests at 0 or 1 before its first or after its last point, may be flat.
+ */
+int easing_load_points(const char *path, struct easing_point **points,
+		size_t *count) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "could not open curve %s: %s\n", path,
+				strerror(errno));
+		return -1;
+	}
+
+	struct easing_point *list = NULL;
+	size_t len = 0, cap = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	int lineno = 0;
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		char *p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '\n' || *p == '#') {
+			continue;
+		}
+
+		struct easing_point point;
+		if (sscanf(p, "%lf %lf", &point.time, &point.progress) != 2 ||
+				!(point.time >= 0.0 && point.time <= 1.0) ||
+				!(point.progress >= 0.0 && point.progress <= 1.0) ||
+				(len > 0 && (point.time <= list[len - 1].time ||
+					point.progress <= list[len - 1].progress))) {
+			fprintf(stderr, "invalid point on line %d of curve %s\n",
+					lineno, path);
+			goto error;
+		}
+
+		if (len == cap) {
+			cap = cap ? cap * 2 : 16;
+			struct easing_point *new_list =
+				realloc(list, cap * sizeof *new_list);
+			if (new_list == NULL) {
+				fprintf(stderr, "could not allocate curve\n");
+				goto error;
+			}
+			list = new_list;
+		}
+		list[len++] = point;
+	}
+	if (len == 0) {
+		fprintf(stderr, "curve %s has no points\n", path);
+		goto error;
+	}
+
+	free(line);
+	fclose(f);
+	*points = list;
+	*count = len;
+	return 0;
+
+error:
+	free(line);
+	free(list);
+	fclose(f);
+	return -1;
+}
+
+static double eval_points(const struct easing_point *points, size_t count,
+		double time) {
+	struct easing_point prev = { 0.0, 0.0 };
+	for (size_t i = 0; i < count; i++) {
+		if (time <= points[i].time) {
+			if (points[i].time == prev.time) {
+				return points[i].progress;
+			}
+			double factor = (time - prev.time) / (points[i].time - prev.time);
+			return prev.progress + (points[i].progress - prev.progress) * factor;
+		}
+		prev = points[i];
+	}
+	if (prev.time == 1.0) {
+		return prev.progress;
+	}
+	double factor = (time - prev.time) / (1.0 - prev.time);
+	return prev.progress + (1.0 - prev.progress) * factor;
+}
+
+// Linear in mired, expressed as progress in kelvin
+static double mired_progress(int temp_start, int temp_stop, double time) {
+	double mired = 1e6 / temp_start + (1e6 / temp_stop - 1e6 / temp_start) * time;
+	return (1e6 / mired - temp_start) / (temp_stop - temp_start);
+}
+
+// A logistic curve, scaled to pass through 0 and 1
+static double sigmoid_progress(double time) {
+	const double steepness = 10.0;
+	double lo = 1.0 / (1.0 + exp(steepness / 2.0));
+	double hi = 1.0 / (1.0 + exp(-steepness / 2.0));
+	double value = 1.0 / (1.0 + exp(-steepness * (time - 0.5)));
+	return (value - lo) / (hi - lo);
+}
+
+static double eval_curve(enum easing_curve curve,
+		const struct easing_point *points, size_t count,
+		int temp_start, int temp_stop, double time) {
+	switch (curve) {
+	case EASING_MIRED:
+		return mired_progress(temp_start, temp_stop, time);
+	case EASING_SMOOTHSTEP:
+		return time * time * (3.0 - 2.0 * time);
+	case EASING_SIGMOID:
+		return sigmoid_progress(time);
+	case EASING_POINTS:
+		return eval_points(points, count, time);
+	case EASING_LINEAR:
+	default:
+		return time;
+	}
+}
+
+void easing_compile(struct easing *easing, enum easing_curve curve,
+		const struct easing_point *points, size_t count,
+		int temp_start, int temp_stop) {
+	// Linear transitions skip the table, so that they stay exact
+	easing->identity = curve == EASING_LINEAR;
+	if (easing->identity) {
+		return;
+	}
+	for (int i = 0; i <= EASING_ENTRIES; i++) {
+		easing->table[i] = eval_curve(curve, points, count, temp_start,
+				temp_stop, (double)i / EASING_ENTRIES);
+	}
+}
+
+double easing_eval(const struct easing *easing, double time) {
+	if (easing->identity) {
+		return time;
+	}
+	double pos = time * EASING_ENTRIES;
+	if (!(pos > 0.0)) {
+		return easing->table[0];
+	} else if (pos >= EASING_ENTRIES) {
+		return easing->table[EASING_ENTRIES];
+	}
+	int idx = (int)pos;
+	double factor = pos - idx;
+	return easing->table[idx] +
+		(easing->table[idx + 1] - easing->table[idx]) * factor;
+}
+
+/*
+ * Returns the earliest time at which the curve reaches progress, which is
+ * well-defined as curves never decrease. Curves are only flat at 0 or 1.
+ */
+double easing_invert(const struct easing *easing, double progress) {
+	if (easing->identity) {
+		return progress;
+	}
+	if (progress <= easing->table[0]) {
+		return 0.0;
+	} else if (progress > easing->table[EASING_ENTRIES]) {
+		return 1.0;
+	}
+
+	// Find the first entry at or above progress
+	int lo = 0, hi = EASING_ENTRIES;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (easing->table[mid] >= progress) {
+			hi = mid;
+		} else {
+			lo = mid;
+		}
+	}
+	double span = easing->table[hi] - easing->table[lo];
+	double factor = span > 0.0 ? (progress - easing->table[lo]) / span : 0.0;
+	return (lo + factor) / EASING_ENTRIES;
+}
@@ -0,0 +1,40 @@
+#ifndef _EASING_H
+#define _EASING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum easing_curve {
+	EASING_LINEAR,
+	EASING_MIRED,
+	EASING_SMOOTHSTEP,
+	EASING_SIGMOID,
+	EASING_POINTS,
+};
+
+struct easing_point {
+	double time;
+	double progress;
+};
+
+#define EASING_ENTRIES 256
+
+/*
+ * A transition curve from one temperature to another, mapping the progress in
+ * time to the progress in kelvin, both from 0 to 1. The curve is sampled into
+ * a table once, so that evaluating it is a lookup and a lerp.
+ */
+struct easing {
+	bool identity;
+	double table[EASING_ENTRIES + 1];
+};
+
+int easing_load_points(const char *path, struct easing_point **points,
+		size_t *count);
+void easing_compile(struct easing *easing, enum easing_curve curve,
+		const struct easing_point *points, size_t count,
+		int temp_start, int temp_stop);
+double easing_eval(const struct easing *easing, double time);
+double easing_invert(const struct easing *easing, double progress);
+
+#endif
@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "color_math.h"
+#include "fill_pool.h"
+
+/*
+ * A small pool of threads filling gamma tables. The calling thread takes part
+ * in every run, so a pool of n threads fills up to n + 1 tables at once.
+ */
+struct fill_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	struct fill_job *jobs;
+	size_t job_count;
+	size_t next_job;
+	size_t jobs_done;
+	bool stop;
+
+	int thread_count;
+	pthread_t threads[];
+};
+
+static void run_job(struct fill_job *job) {
+	fill_gamma_table(job->table, job->ramp_size, job->rw, job->gw, job->bw,
+			job->gamma);
+}
+
+// Must be called with the lock held, which is released while filling.
+static void run_jobs(struct fill_pool *pool) {
+	while (pool->next_job < pool->job_count) {
+		struct fill_job *job = &pool->jobs[pool->next_job++];
+		pthread_mutex_unlock(&pool->lock);
+		run_job(job);
+		pthread_mutex_lock(&pool->lock);
+		if (++pool->jobs_done == pool->job_count) {
+			pthread_cond_signal(&pool->done_cond);
+		}
+	}
+}
+
+static void *worker(void *data) {
+	struct fill_pool *pool = data;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		run_jobs(pool);
+		pthread_cond_wait(&pool->work_cond, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct fill_pool *fill_pool_create(int threads) {
+	struct fill_pool *pool = calloc(1,
+			sizeof(struct fill_pool) + threads * sizeof(pthread_t));
+	if (pool == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	// Workers inherit our signal mask. Signals are left to the main thread,
+	// where they are expected to interrupt poll.
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+			break;
+		}
+		pool->thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (pool->thread_count < threads) {
+		fill_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+void fill_pool_run(struct fill_pool *pool, struct fill_job *jobs, size_t count) {
+	if (pool == NULL || count < 2) {
+		for (size_t i = 0; i < count; i++) {
+			run_job(&jobs[i]);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->jobs = jobs;
+	pool->job_count = count;
+	pool->next_job = 0;
+	pool->jobs_done = 0;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	run_jobs(pool);
+	while (pool->jobs_done < pool->job_count) {
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void fill_pool_destroy(struct fill_pool *pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->thread_count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
@@ -0,0 +1,20 @@
+#ifndef _FILL_POOL_H
+#define _FILL_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct fill_job {
+	uint16_t *table;
+	uint32_t ramp_size;
+	double rw, gw, bw;
+	double gamma;
+};
+
+struct fill_pool;
+
+struct fill_pool *fill_pool_create(int threads);
+void fill_pool_run(struct fill_pool *pool, struct fill_job *jobs, size_t count);
+void fill_pool_destroy(struct fill_pool *pool);
+
+#endif
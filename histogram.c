@@ -0,0 +1,58 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+void histogram_add(struct histogram *histogram, double usec) {
+	if (usec < 0.0) {
+		usec = 0.0;
+	}
+
+	int bucket = 0;
+	if (usec >= 1.0) {
+		bucket = ilogb(usec) + 1;
+		if (bucket >= HISTOGRAM_BUCKETS) {
+			bucket = HISTOGRAM_BUCKETS - 1;
+		}
+	}
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum += usec;
+	if (usec > histogram->max) {
+		histogram->max = usec;
+	}
+}
+
+static void print_bound(double usec, FILE *f) {
+	if (usec < 1000.0) {
+		fprintf(f, "%.0fus", usec);
+	} else if (usec < 1000000.0) {
+		fprintf(f, "%.0fms", usec / 1000.0);
+	} else {
+		fprintf(f, "%.0fs", usec / 1000000.0);
+	}
+}
+
+void histogram_print(const struct histogram *histogram, FILE *f) {
+	fprintf(f, "%s: %u samples", histogram->name, histogram->count);
+	if (histogram->count == 0) {
+		fprintf(f, "\n");
+		return;
+	}
+	fprintf(f, ", mean %.1fus, max %.1fus\n",
+			histogram->sum / histogram->count, histogram->max);
+
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (histogram->buckets[i] == 0) {
+			continue;
+		}
+		if (i == HISTOGRAM_BUCKETS - 1) {
+			fprintf(f, "  >= ");
+			print_bound(ldexp(1.0, i - 1), f);
+		} else {
+			fprintf(f, "  < ");
+			print_bound(ldexp(1.0, i), f);
+		}
+		fprintf(f, ": %u\n", histogram->buckets[i]);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bucket 0 counts values below 1us, bucket n values in [2^(n-1), 2^n) us
+#define HISTOGRAM_BUCKETS 32
+
+struct histogram {
+	const char *name;
+	uint32_t count;
+	double sum;
+	double max;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+void histogram_add(struct histogram *histogram, double usec);
+void histogram_print(const struct histogram *histogram, FILE *f);
+
+#endif
@@ -1,13 +1,17 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -16,57 +20,28 @@
 
 #include "wlr-gamma-control-unstable-v1-client-protocol.h"
 #include "color_math.h"
+#include "control.h"
+#include "easing.h"
+#include "fill_pool.h"
+#include "histogram.h"
 
-#if defined(SPEEDRUN)
-static time_t start = 0, offset = 0, multiplier = 1000;
-static void init_time(void) {
-	tzset();
-	struct timespec realtime;
-	clock_gettime(CLOCK_REALTIME, &realtime);
-	offset = realtime.tv_sec;
-
-	char *startstr = getenv("SPEEDRUN_START");
-	if (startstr != NULL) {
-		start = atol(startstr);
-	} else {
-		start = offset;
-	}
-
-	char *multistr = getenv("SPEEDRUN_MULTIPLIER");
-	if (multistr != NULL) {
-		multiplier = atol(multistr);
-	}
-}
 static time_t get_time_sec(void) {
 	struct timespec realtime;
 	clock_gettime(CLOCK_REALTIME, &realtime);
-	time_t now = start + ((realtime.tv_sec - offset) * multiplier +
-			realtime.tv_nsec / (1000000000 / multiplier));
-	struct tm tm;
-	localtime_r(&now, &tm);
-	fprintf(stderr, "time in termina: %02d:%02d:%02d, %d/%d/%d\n",
-			tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_mday,
-			tm.tm_mon+1, tm.tm_year + 1900);
-	return now;
-}
-static void adjust_timerspec(struct itimerspec *timerspec) {
-	int diff = timerspec->it_value.tv_sec - offset;
-	timerspec->it_value.tv_sec = offset + diff / multiplier;
-	timerspec->it_value.tv_nsec = (diff % multiplier) * (1000000000 / multiplier);
-}
-#else
-static inline void init_time(void) {
-	tzset();
+	return realtime.tv_sec;
 }
-static inline time_t get_time_sec(void) {
+
+static double get_time_ms_since(time_t then) {
 	struct timespec realtime;
 	clock_gettime(CLOCK_REALTIME, &realtime);
-	return realtime.tv_sec;
+	return (realtime.tv_sec - then) * 1000.0 + realtime.tv_nsec / 1000000.0;
 }
-static inline void adjust_timerspec(struct itimerspec *timerspec) {
-	(void)timerspec;
+
+static double get_monotonic_us(void) {
+	struct timespec monotonic;
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	return monotonic.tv_sec * 1000000.0 + monotonic.tv_nsec / 1000.0;
 }
-#endif
 
 static time_t round_day_offset(time_t now, time_t offset) {
 	return now - ((now - offset) % 86400);
@@ -80,6 +55,15 @@ static time_t longitude_time_offset(double longitude) {
 	return longitude * 43200 / M_PI;
 }
 
+// The range of the whitepoint curve. Steps are spaced in mired, 1e6 / temp,
+// which also rules out temperatures at or below zero.
+#define MIN_TEMP 1000
+#define MAX_TEMP 25000
+
+static bool valid_temp(int temp) {
+	return temp >= MIN_TEMP && temp <= MAX_TEMP;
+}
+
 struct config {
 	int high_temp;
 	int low_temp;
@@ -87,11 +71,22 @@ struct config {
 
 	double longitude;
 	double latitude;
+	enum sun_model sun_model;
+	bool elevation;
+
+	enum easing_curve curve;
+	struct easing_point *curve_points;
+	size_t curve_points_len;
 
 	bool manual_time;
 	time_t sunrise;
 	time_t sunset;
 	time_t duration;
+
+	int hotplug_delay;
+	int fill_threads;
+	bool control_socket;
+	bool timings;
 };
 
 enum state {
@@ -101,22 +96,97 @@ enum state {
 	STATE_STATIC,
 };
 
+struct schedule_step {
+	time_t time;
+	int temp;
+	double rw, gw, bw;
+};
+
 struct context {
 	struct config config;
 	struct sun sun;
 
 	double longitude_time_offset;
+	struct sun_elevation_fit elevation_fit;
+	struct easing rise_curve;
+	struct easing fall_curve;
 
 	enum state state;
 	enum sun_condition condition;
 
-	time_t dawn_step_time;
-	time_t dusk_step_time;
 	time_t calc_day;
 
+	// Every temperature change of calc_day, in order
+	struct schedule_step *schedule;
+	size_t schedule_len;
+	size_t schedule_cap;
+	size_t schedule_pos;
+
 	bool new_output;
 	struct wl_list outputs;
-	timer_t timer;
+
+	uint32_t commit_serial;
+	int committed_temp;
+	unsigned long table_fills;
+	unsigned long table_copies;
+
+	// Outputs with a prepare_serial equal to this one have the table for
+	// prepared_temp ready as their next table
+	uint32_t prepare_serial;
+	int prepared_temp;
+
+	struct fill_pool *fill_pool;
+	struct fill_job *fill_jobs;
+	size_t fill_jobs_len;
+	size_t fill_jobs_cap;
+
+	int timer_fd;
+	bool timer_fired;
+
+	// Outputs announced at runtime are set up in batches, once
+	// config.hotplug_delay milliseconds have passed since the first one.
+	bool outputs_pending;
+	int hotplug_timer_fd;
+	bool hotplug_timer_armed;
+	bool hotplug_timer_fired;
+
+	// Signal handlers write the signal number to a pipe that is polled
+	// with everything else, so that a signal cannot slip in between
+	// checking for it and going to sleep.
+	int signal_fd;
+	bool stats_requested;
+	bool quit_requested;
+
+	// Timings of each step, recorded with config.timings and dumped to
+	// stderr on SIGUSR1. flush_start is the time of the last commit that
+	// has not been flushed yet, or 0.
+	struct histogram wake_lateness;
+	struct histogram commit_latency;
+	struct histogram commit_time;
+	struct histogram prepare_time;
+	struct histogram flush_time;
+	double flush_start;
+
+	// Requests from the control socket are applied by the main loop once
+	// reconfigured is set, rebuilding the schedule if schedule_stale is
+	// set. While paused, the schedule is not followed, and forced_temp is
+	// used instead if set.
+	struct control *control;
+	bool reconfigured;
+	bool schedule_stale;
+	bool paused;
+	int forced_temp;
+};
+
+/*
+ * Each commit hands the compositor a different table of the ring, so a table
+ * is never rewritten while the compositor may still be reading it.
+ */
+#define GAMMA_TABLE_BUFFERS 3
+
+struct gamma_table {
+	int fd;
+	uint16_t *data;
 };
 
 struct output {
@@ -126,10 +196,21 @@ struct output {
 	struct wl_output *wl_output;
 	struct zwlr_gamma_control_v1 *gamma_control;
 
-	int table_fd;
 	uint32_t id;
 	uint32_t ramp_size;
-	uint16_t *table;
+	bool dirty;
+	// Announced but not yet set up. Outputs whose gamma control failed
+	// are not set up again.
+	bool needs_setup;
+	struct gamma_table tables[GAMMA_TABLE_BUFFERS];
+	int next_table;
+
+	// The table last sent to the compositor, and the last commit round
+	// the output took part in
+	uint32_t commit_serial;
+	struct gamma_table *committed_table;
+
+	uint32_t prepare_serial;
 };
 
 static void print_trajectory(struct context *ctx) {
@@ -159,88 +240,17 @@ static void print_trajectory(struct context *ctx) {
 	}
 }
 
-static int anim_kelvin_step = 25;
-
-static void recalc_stops(struct context *ctx, time_t now) {
-	time_t day = round_day_offset(now, -ctx->longitude_time_offset);
-	if (day == ctx->calc_day) {
-		return;
-	}
-
-	time_t last_day = ctx->calc_day;
-	ctx->calc_day = day;
-
-	enum sun_condition cond = NORMAL;
-
-	if (ctx->config.manual_time) {
-		ctx->state = STATE_NORMAL;
-		ctx->sun.dawn = ctx->config.sunrise - ctx->config.duration + day;
-		ctx->sun.sunrise = ctx->config.sunrise + day;
-		ctx->sun.sunset = ctx->config.sunset + day;
-		ctx->sun.dusk = ctx->config.sunset + ctx->config.duration + day;
-
-		goto done;
-	}
-
-	struct sun sun;
-	struct tm tm = { 0 };
-	gmtime_r(&day, &tm);
-	cond = calc_sun(&tm, ctx->config.latitude, &sun);
-
-	switch (cond) {
-	case NORMAL:
-		ctx->state = STATE_NORMAL;
-		ctx->sun.dawn = sun.dawn + day;
-		ctx->sun.sunrise = sun.sunrise + day;
-		ctx->sun.sunset = sun.sunset + day;
-		ctx->sun.dusk = sun.dusk + day;
-
-		if (ctx->condition == MIDNIGHT_SUN) {
-			// Yesterday had no sunset, so remove our sunrise.
-			ctx->sun.dawn = day;
-			ctx->sun.sunrise = day;
-		}
-
-		break;
-	case MIDNIGHT_SUN:
-		if (ctx->condition == POLAR_NIGHT) {
-			fprintf(stderr, "warning: direct polar night to midnight sun transition\n");
-		}
-
-		if (ctx->state != STATE_NORMAL) {
-			ctx->state = STATE_STATIC;
-			break;
-		}
-
-		// Borrow yesterday's sunrise to animate into the midnight sun
-		sun.dawn = ctx->sun.dawn - last_day + day;
-		sun.sunrise = ctx->sun.sunrise - last_day + day;
-		ctx->state = STATE_TRANSITION;
-		break;
-	case POLAR_NIGHT:
-		if (ctx->condition == MIDNIGHT_SUN) {
-			fprintf(stderr, "warning: direct midnight sun to polar night transition\n");
-		}
-		ctx->state = STATE_STATIC;
-		break;
-	default:
-		abort();
-	}
-
-done:
-	ctx->condition = cond;
-
-	int temp_diff = ctx->config.high_temp - ctx->config.low_temp;
-	ctx->dawn_step_time = (ctx->sun.sunrise - ctx->sun.dawn) *
-		anim_kelvin_step / temp_diff;
-	ctx->dusk_step_time = (ctx->sun.dusk - ctx->sun.sunset) *
-		anim_kelvin_step / temp_diff;
-
-	print_trajectory(ctx);
-}
-
-static int interpolate_temperature(time_t now, time_t start, time_t stop,
-		int temp_start, int temp_stop) {
+/*
+ * Transitions step in equal increments of mired (micro reciprocal degrees)
+ * rather than kelvin, as perceived change follows the reciprocal of the
+ * temperature: a kelvin step is hard to see at 6500K but not at 2500K. 2
+ * mired is below what is visible at any temperature, and corresponds to 85K
+ * at 6500K, 32K at 4000K and 12K at 2500K.
+ */
+static double anim_mired_step = 2.0;
+
+static int interpolate_temperature(const struct easing *curve, time_t now,
+		time_t start, time_t stop, int temp_start, int temp_stop) {
 	if (start == stop) {
 		return stop;
 	}
@@ -250,23 +260,48 @@ static int interpolate_temperature(time_t now, time_t start, time_t stop,
 	} else if (time_pos < 0.0) {
 		time_pos = 0.0;
 	}
-	int temp_pos = (double)(temp_stop - temp_start) * time_pos;
+	int temp_pos = (double)(temp_stop - temp_start) *
+		easing_eval(curve, time_pos);
 	return temp_start + temp_pos;
 }
 
+/*
+ * Returns the time at which a transition from temp_start to temp_stop between
+ * start and stop has moved anim_mired_step away from its temperature at now.
+ * Steps follow the curve, so they are closer together where it is steeper.
+ */
+static time_t next_step_time(const struct easing *curve, time_t now,
+		time_t start, time_t stop, int temp_start, int temp_stop) {
+	int temp = interpolate_temperature(curve, now, start, stop, temp_start,
+			temp_stop);
+	double mired = 1e6 / temp;
+	mired += temp_stop > temp_start ? -anim_mired_step : anim_mired_step;
+
+	double progress = (1e6 / mired - temp_start) / (temp_stop - temp_start);
+	if (progress >= 1.0) {
+		return stop;
+	}
+	double pos = easing_invert(curve, progress);
+	if (pos >= 1.0) {
+		return stop;
+	}
+	time_t next = start + (time_t)ceil(pos * (stop - start));
+	return next > now ? next : now + 1;
+}
+
 static int get_temperature_normal(const struct context *ctx, time_t now) {
 	if (now < ctx->sun.dawn) {
 		return ctx->config.low_temp;
 	} else if (now < ctx->sun.sunrise) {
-		return interpolate_temperature(now, ctx->sun.dawn,
-				ctx->sun.sunrise, ctx->config.low_temp,
-				ctx->config.high_temp);
+		return interpolate_temperature(&ctx->rise_curve, now,
+				ctx->sun.dawn, ctx->sun.sunrise,
+				ctx->config.low_temp, ctx->config.high_temp);
 	} else if (now < ctx->sun.sunset) {
 		return ctx->config.high_temp;
 	} else if (now < ctx->sun.dusk) {
-		return interpolate_temperature(now, ctx->sun.sunset,
-				ctx->sun.dusk, ctx->config.high_temp,
-				ctx->config.low_temp);
+		return interpolate_temperature(&ctx->fall_curve, now,
+				ctx->sun.sunset, ctx->sun.dusk,
+				ctx->config.high_temp, ctx->config.low_temp);
 	} else {
 		return ctx->config.low_temp;
 	}
@@ -284,7 +319,7 @@ static int get_temperature_transition(const struct context *ctx, time_t now) {
 	}
 }
 
-static int get_temperature(const struct context *ctx, time_t now) {
+static int calc_temperature(const struct context *ctx, time_t now) {
 	switch (ctx->state) {
 	case STATE_NORMAL:
 		return get_temperature_normal(ctx, now);
@@ -302,11 +337,15 @@ static time_t get_deadline_normal(const struct context *ctx, time_t now) {
 	if (now < ctx->sun.dawn) {
 		return ctx->sun.dawn;
 	} else if (now < ctx->sun.sunrise) {
-		return now + ctx->dawn_step_time;
+		return next_step_time(&ctx->rise_curve, now, ctx->sun.dawn,
+				ctx->sun.sunrise, ctx->config.low_temp,
+				ctx->config.high_temp);
 	} else if (now < ctx->sun.sunset) {
 		return ctx->sun.sunset;
 	} else if (now < ctx->sun.dusk) {
-		return now + ctx->dusk_step_time;
+		return next_step_time(&ctx->fall_curve, now, ctx->sun.sunset,
+				ctx->sun.dusk, ctx->config.high_temp,
+				ctx->config.low_temp);
 	} else {
 		return tomorrow(now, -ctx->longitude_time_offset);
 	}
@@ -326,7 +365,7 @@ static time_t get_deadline_transition(const struct context *ctx, time_t now) {
 	}
 }
 
-static void update_timer(const struct context *ctx, timer_t timer, time_t now) {
+static time_t calc_deadline(const struct context *ctx, time_t now) {
 	time_t deadline;
 	switch (ctx->state) {
 	case STATE_NORMAL:
@@ -343,6 +382,238 @@ static void update_timer(const struct context *ctx, timer_t timer, time_t now) {
 	}
 
 	assert(deadline > now);
+	return deadline;
+}
+
+static void add_step(struct context *ctx, time_t time, int temp) {
+	if (ctx->schedule_len == ctx->schedule_cap) {
+		size_t cap = ctx->schedule_cap ? ctx->schedule_cap * 2 : 64;
+		struct schedule_step *schedule =
+			realloc(ctx->schedule, cap * sizeof *schedule);
+		if (schedule == NULL) {
+			fprintf(stderr, "could not allocate schedule\n");
+			exit(EXIT_FAILURE);
+		}
+		ctx->schedule = schedule;
+		ctx->schedule_cap = cap;
+	}
+
+	struct schedule_step *step = &ctx->schedule[ctx->schedule_len++];
+	step->time = time;
+	step->temp = temp;
+	calc_whitepoint(temp, &step->rw, &step->gw, &step->bw);
+}
+
+/*
+ * In elevation mode, the temperature moves from low to high as the sine of
+ * the elevation of the sun moves from its value at dawn to that at sunrise,
+ * which is nearly linear in the elevation this close to the horizon.
+ */
+static int get_temperature_elevation(const struct context *ctx, time_t now) {
+	double elevation = eval_sun_elevation(&ctx->elevation_fit,
+			now - ctx->calc_day);
+	double pos = (elevation - SUN_ELEVATION_TWILIGHT) /
+		(SUN_ELEVATION_DAYLIGHT - SUN_ELEVATION_TWILIGHT);
+	if (pos > 1.0) {
+		pos = 1.0;
+	} else if (pos < 0.0) {
+		pos = 0.0;
+	}
+	int temp_pos = (double)(ctx->config.high_temp - ctx->config.low_temp) *
+		easing_eval(&ctx->rise_curve, pos);
+	return ctx->config.low_temp + temp_pos;
+}
+
+static bool elevation_step_due(const struct context *ctx, int temp, int from) {
+	if (temp == from) {
+		return false;
+	}
+	return temp == ctx->config.low_temp || temp == ctx->config.high_temp ||
+		fabs(1e6 / temp - 1e6 / from) >= anim_mired_step;
+}
+
+/*
+ * The elevation curve is scanned a minute at a time, and every minute in
+ * which the temperature moves a step is bisected to the second the step is
+ * due. The temperature cannot move back and forth by a whole step within a
+ * minute, as the sun moves by at most a quarter of a degree.
+ */
+static void build_schedule_elevation(struct context *ctx) {
+	time_t day_end = ctx->calc_day + 86400;
+	time_t now = ctx->calc_day;
+	int temp = get_temperature_elevation(ctx, now);
+	add_step(ctx, now, temp);
+
+	while (now < day_end) {
+		time_t next = now + 60 < day_end ? now + 60 : day_end;
+		if (!elevation_step_due(ctx, get_temperature_elevation(ctx, next), temp)) {
+			now = next;
+			continue;
+		}
+
+		time_t lo = now;
+		while (next - lo > 1) {
+			time_t mid = lo + (next - lo) / 2;
+			if (elevation_step_due(ctx, get_temperature_elevation(ctx, mid), temp)) {
+				next = mid;
+			} else {
+				lo = mid;
+			}
+		}
+		now = next;
+		temp = get_temperature_elevation(ctx, now);
+		add_step(ctx, now, temp);
+	}
+}
+
+/*
+ * Compiles every temperature change of calc_day into the schedule, so that
+ * wakeups only need to advance through it.
+ */
+static void build_schedule(struct context *ctx) {
+	ctx->schedule_stale = false;
+	struct config *cfg = &ctx->config;
+	easing_compile(&ctx->rise_curve, cfg->curve, cfg->curve_points,
+			cfg->curve_points_len, cfg->low_temp, cfg->high_temp);
+	easing_compile(&ctx->fall_curve, cfg->curve, cfg->curve_points,
+			cfg->curve_points_len, cfg->high_temp, cfg->low_temp);
+
+	ctx->schedule_len = 0;
+	ctx->schedule_pos = 0;
+	if (ctx->config.elevation) {
+		build_schedule_elevation(ctx);
+		return;
+	}
+
+	time_t day_end = ctx->calc_day + 86400;
+	int old_temp = -1;
+	for (time_t now = ctx->calc_day; now < day_end;
+			now = calc_deadline(ctx, now)) {
+		int temp = calc_temperature(ctx, now);
+		if (temp == old_temp) {
+			continue;
+		}
+		old_temp = temp;
+		add_step(ctx, now, temp);
+	}
+}
+
+static void recalc_stops(struct context *ctx, time_t now) {
+	time_t day = round_day_offset(now, -ctx->longitude_time_offset);
+	if (day == ctx->calc_day) {
+		return;
+	}
+
+	time_t last_day = ctx->calc_day;
+	ctx->calc_day = day;
+
+	enum sun_condition cond = NORMAL;
+
+	if (ctx->config.manual_time) {
+		ctx->state = STATE_NORMAL;
+		ctx->sun.dawn = ctx->config.sunrise - ctx->config.duration + day;
+		ctx->sun.sunrise = ctx->config.sunrise + day;
+		ctx->sun.sunset = ctx->config.sunset + day;
+		ctx->sun.dusk = ctx->config.sunset + ctx->config.duration + day;
+
+		goto done;
+	}
+
+	struct sun sun;
+	struct tm tm = { 0 };
+	gmtime_r(&day, &tm);
+	struct sun_day sun_day;
+	struct sun_site site;
+	calc_sun_day(&tm, ctx->config.sun_model, &sun_day);
+	calc_sun_site(ctx->config.latitude, &site);
+	cond = calc_sun_at(&sun_day, &site, &sun);
+	if (ctx->config.elevation) {
+		fit_sun_elevation(&sun_day, &site, &ctx->elevation_fit);
+	}
+
+	switch (cond) {
+	case NORMAL:
+		ctx->state = STATE_NORMAL;
+		ctx->sun.dawn = sun.dawn + day;
+		ctx->sun.sunrise = sun.sunrise + day;
+		ctx->sun.sunset = sun.sunset + day;
+		ctx->sun.dusk = sun.dusk + day;
+
+		if (ctx->condition == MIDNIGHT_SUN) {
+			// Yesterday had no sunset, so remove our sunrise.
+			ctx->sun.dawn = day;
+			ctx->sun.sunrise = day;
+		}
+
+		break;
+	case MIDNIGHT_SUN:
+		if (ctx->condition == POLAR_NIGHT) {
+			fprintf(stderr, "warning: direct polar night to midnight sun transition\n");
+		}
+
+		if (ctx->state != STATE_NORMAL) {
+			ctx->state = STATE_STATIC;
+			break;
+		}
+
+		// Borrow yesterday's sunrise to animate into the midnight sun
+		sun.dawn = ctx->sun.dawn - last_day + day;
+		sun.sunrise = ctx->sun.sunrise - last_day + day;
+		ctx->state = STATE_TRANSITION;
+		break;
+	case POLAR_NIGHT:
+		if (ctx->condition == MIDNIGHT_SUN) {
+			fprintf(stderr, "warning: direct midnight sun to polar night transition\n");
+		}
+		ctx->state = STATE_STATIC;
+		break;
+	default:
+		abort();
+	}
+
+done:
+	ctx->condition = cond;
+	build_schedule(ctx);
+	print_trajectory(ctx);
+}
+
+/*
+ * Brings the stops and schedule up to date with the configuration, which the
+ * control socket may have changed since the last time they were computed.
+ */
+static void sync_schedule(struct context *ctx, time_t now) {
+	recalc_stops(ctx, now);
+	if (ctx->schedule_stale) {
+		build_schedule(ctx);
+	}
+}
+
+/*
+ * Returns the step in effect at the given time. Time normally only moves
+ * forward, so this resumes from the previous lookup.
+ */
+static const struct schedule_step *get_step(struct context *ctx, time_t now) {
+	assert(ctx->schedule_len > 0);
+	size_t pos = ctx->schedule_pos;
+	if (ctx->schedule[pos].time > now) {
+		pos = 0;
+	}
+	while (pos + 1 < ctx->schedule_len && ctx->schedule[pos + 1].time <= now) {
+		pos++;
+	}
+	ctx->schedule_pos = pos;
+	return &ctx->schedule[pos];
+}
+
+static time_t get_deadline(struct context *ctx, time_t now) {
+	const struct schedule_step *step = get_step(ctx, now);
+	if (step + 1 < ctx->schedule + ctx->schedule_len) {
+		return step[1].time;
+	}
+	return ctx->calc_day + 86400;
+}
+
+static void update_timer(int timer_fd, time_t deadline) {
 	struct itimerspec timerspec = {
 		.it_interval = {0},
 		.it_value = {
@@ -350,18 +621,47 @@ static void update_timer(const struct context *ctx, timer_t timer, time_t now) {
 			.tv_nsec = 0,
 		}
 	};
-	adjust_timerspec(&timerspec);
-	timer_settime(timer, TIMER_ABSTIME, &timerspec, NULL);
+
+	// Cancel-on-set makes the timer fire immediately if the realtime clock
+	// is set, so that e.g. an NTP step does not leave us at the wrong
+	// temperature until the next deadline.
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+			&timerspec, NULL);
 }
 
 static struct zwlr_gamma_control_manager_v1 *gamma_control_manager = NULL;
 
-static int create_anonymous_file(off_t size) {
-	char template[] = "/tmp/wlsunset-shared-XXXXXX";
+static int create_tmpfile(void) {
+	// Prefer the runtime dir, which unlike /tmp is normally not disk-backed
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || dir[0] == '\0') {
+		dir = "/tmp";
+	}
+
+	char template[PATH_MAX];
+	if (snprintf(template, sizeof template, "%s/wlsunset-shared-XXXXXX",
+				dir) >= (int)sizeof template) {
+		return -1;
+	}
 	int fd = mkstemp(template);
 	if (fd < 0) {
 		return -1;
 	}
+	unlink(template);
+	return fd;
+}
+
+static int create_anonymous_file(off_t size) {
+	int fd = -1;
+#if defined(HAVE_MEMFD_CREATE)
+	fd = memfd_create("wlsunset-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+	if (fd < 0) {
+		fd = create_tmpfile();
+	}
+	if (fd < 0) {
+		return -1;
+	}
 
 	int ret;
 	do {
@@ -373,7 +673,11 @@ static int create_anonymous_file(off_t size) {
 		return -1;
 	}
 
-	unlink(template);
+#if defined(HAVE_MEMFD_CREATE)
+	// The size never changes for the lifetime of the table. This fails
+	// harmlessly if we fell back to a regular file.
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
 	return fd;
 }
 
@@ -397,19 +701,46 @@ static int create_gamma_table(uint32_t ramp_size, uint16_t **table) {
 	return fd;
 }
 
-static void gamma_control_handle_gamma_size(void *data,
-		struct zwlr_gamma_control_v1 *gamma_control, uint32_t ramp_size) {
-	(void)gamma_control;
-	struct output *output = data;
-	output->ramp_size = ramp_size;
-	if (output->table_fd != -1) {
-		close(output->table_fd);
+static void destroy_gamma_tables(struct output *output) {
+	size_t table_size = output->ramp_size * 3 * sizeof(uint16_t);
+	for (int i = 0; i < GAMMA_TABLE_BUFFERS; i++) {
+		struct gamma_table *table = &output->tables[i];
+		if (table->fd == -1) {
+			continue;
+		}
+		munmap(table->data, table_size);
+		close(table->fd);
+		table->fd = -1;
+		table->data = NULL;
 	}
-	output->table_fd = create_gamma_table(ramp_size, &output->table);
-	output->context->new_output = true;
-	if (output->table_fd < 0) {
-		fprintf(stderr, "could not create gamma table for output %d\n",
-				output->id);
+}
+
+static int create_gamma_tables(struct output *output) {
+	for (int i = 0; i < GAMMA_TABLE_BUFFERS; i++) {
+		struct gamma_table *table = &output->tables[i];
+		table->fd = create_gamma_table(output->ramp_size, &table->data);
+		if (table->fd < 0) {
+			destroy_gamma_tables(output);
+			return -1;
+		}
+	}
+	output->next_table = 0;
+	return 0;
+}
+
+static void gamma_control_handle_gamma_size(void *data,
+		struct zwlr_gamma_control_v1 *gamma_control, uint32_t ramp_size) {
+	(void)gamma_control;
+	struct output *output = data;
+	destroy_gamma_tables(output);
+	output->ramp_size = ramp_size;
+	output->dirty = true;
+	output->committed_table = NULL;
+	output->prepare_serial = 0;
+	output->context->new_output = true;
+	if (create_gamma_tables(output) == -1) {
+		fprintf(stderr, "could not create gamma table for output %d\n",
+				output->id);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -422,10 +753,8 @@ static void gamma_control_handle_failed(void *data,
 			output->id);
 	zwlr_gamma_control_v1_destroy(output->gamma_control);
 	output->gamma_control = NULL;
-	if (output->table_fd != -1) {
-		close(output->table_fd);
-		output->table_fd = -1;
-	}
+	output->committed_table = NULL;
+	destroy_gamma_tables(output);
 }
 
 static const struct zwlr_gamma_control_v1_listener gamma_control_listener = {
@@ -458,10 +787,13 @@ static void registry_handle_global(void *data, struct wl_registry *registry,
 		output->id = name;
 		output->wl_output = wl_registry_bind(registry, name,
 				&wl_output_interface, 1);
-		output->table_fd = -1;
+		for (int i = 0; i < GAMMA_TABLE_BUFFERS; i++) {
+			output->tables[i].fd = -1;
+		}
 		output->context = ctx;
+		output->needs_setup = true;
 		wl_list_insert(&ctx->outputs, &output->link);
-		setup_output(output);
+		ctx->outputs_pending = true;
 	} else if (strcmp(interface,
 				zwlr_gamma_control_manager_v1_interface.name) == 0) {
 		gamma_control_manager = wl_registry_bind(registry, name,
@@ -481,9 +813,7 @@ static void registry_handle_global_remove(void *data,
 			if (output->gamma_control != NULL) {
 				zwlr_gamma_control_v1_destroy(output->gamma_control);
 			}
-			if (output->table_fd != -1) {
-				close(output->table_fd);
-			}
+			destroy_gamma_tables(output);
 			free(output);
 			break;
 		}
@@ -495,48 +825,478 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = registry_handle_global_remove,
 };
 
-static void fill_gamma_table(uint16_t *table, uint32_t ramp_size, double rw,
-		double gw, double bw, double gamma) {
-	uint16_t *r = table;
-	uint16_t *g = table + ramp_size;
-	uint16_t *b = table + 2 * ramp_size;
-	for (uint32_t i = 0; i < ramp_size; ++i) {
-		double val = (double)i / (ramp_size - 1);
-		r[i] = (uint16_t)(UINT16_MAX * pow(val * rw, 1.0 / gamma));
-		g[i] = (uint16_t)(UINT16_MAX * pow(val * gw, 1.0 / gamma));
-		b[i] = (uint16_t)(UINT16_MAX * pow(val * bw, 1.0 / gamma));
+/*
+ * Returns an output earlier in the list that got its content from the same
+ * commit round and has the same ramp size, if any. Temperature and gamma are
+ * the same for all outputs within a round, so such an output has the exact
+ * same table.
+ */
+static struct output *find_commit_twin(struct context *ctx,
+		struct output *output) {
+	struct output *other;
+	wl_list_for_each(other, &ctx->outputs, link) {
+		if (other == output) {
+			break;
+		}
+		if (other->commit_serial == output->commit_serial &&
+				other->ramp_size == output->ramp_size) {
+			return other;
+		}
 	}
+	return NULL;
 }
 
-static void set_temperature(struct wl_list *outputs, int temp, double gamma) {
-	double rw, gw, bw;
-	calc_whitepoint(temp, &rw, &gw, &bw);
-	fprintf(stderr, "setting temperature to %d K\n", temp);
+static struct output *find_prepared_twin(struct context *ctx,
+		struct output *output) {
+	struct output *other;
+	wl_list_for_each(other, &ctx->outputs, link) {
+		if (other == output) {
+			break;
+		}
+		if (other->prepare_serial == output->prepare_serial &&
+				other->ramp_size == output->ramp_size) {
+			return other;
+		}
+	}
+	return NULL;
+}
+
+static bool output_is_ready(struct output *output) {
+	return output->gamma_control != NULL && output->tables[0].fd != -1;
+}
+
+static struct gamma_table *next_table(struct output *output) {
+	return &output->tables[output->next_table];
+}
+
+static size_t table_size(struct output *output) {
+	return output->ramp_size * 3 * sizeof(uint16_t);
+}
+
+static void add_fill_job(struct context *ctx, struct output *output,
+		const struct schedule_step *step) {
+	if (ctx->fill_jobs_len == ctx->fill_jobs_cap) {
+		size_t cap = ctx->fill_jobs_cap ? ctx->fill_jobs_cap * 2 : 8;
+		struct fill_job *jobs =
+			realloc(ctx->fill_jobs, cap * sizeof *jobs);
+		if (jobs == NULL) {
+			fprintf(stderr, "could not allocate fill jobs\n");
+			exit(EXIT_FAILURE);
+		}
+		ctx->fill_jobs = jobs;
+		ctx->fill_jobs_cap = cap;
+	}
+	ctx->fill_jobs[ctx->fill_jobs_len++] = (struct fill_job){
+		.table = next_table(output)->data,
+		.ramp_size = output->ramp_size,
+		.rw = step->rw,
+		.gw = step->gw,
+		.bw = step->bw,
+		.gamma = ctx->config.gamma,
+	};
+}
+
+static void run_fill_jobs(struct context *ctx) {
+	fill_pool_run(ctx->fill_pool, ctx->fill_jobs, ctx->fill_jobs_len);
+	ctx->fill_jobs_len = 0;
+}
 
+/*
+ * Fills the next table of every output for the given step, so that it can be
+ * handed over without further work once the step is due. Returns whether
+ * committing the step would change the table of any output, or true if there
+ * is no table to compare against.
+ */
+static bool prepare_tables(struct context *ctx,
+		const struct schedule_step *step) {
+	ctx->prepare_serial++;
+	ctx->prepared_temp = step->temp;
+
+	// Distinct tables are filled first, possibly in parallel, and then
+	// copied to the outputs that share them.
 	struct output *output;
-	wl_list_for_each(output, outputs, link) {
-		if (output->gamma_control == NULL || output->table_fd == -1) {
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output_is_ready(output)) {
 			continue;
 		}
-		fill_gamma_table(output->table, output->ramp_size,
-				rw, gw, bw, gamma);
-		lseek(output->table_fd, 0, SEEK_SET);
+		output->prepare_serial = ctx->prepare_serial;
+		if (find_prepared_twin(ctx, output) == NULL) {
+			add_fill_job(ctx, output, step);
+		}
+	}
+	run_fill_jobs(ctx);
+
+	bool changed = false, compared = false;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output_is_ready(output)) {
+			continue;
+		}
+		struct gamma_table *table = next_table(output);
+		struct output *twin = find_prepared_twin(ctx, output);
+		if (twin != NULL) {
+			memcpy(table->data, next_table(twin)->data,
+					table_size(output));
+		}
+
+		if (output->committed_table == NULL || memcmp(table->data,
+					output->committed_table->data,
+					table_size(output)) != 0) {
+			changed = true;
+		}
+		compared = true;
+	}
+	return changed || !compared;
+}
+
+/*
+ * Returns the first deadline today at which committing would change the
+ * table of any output, skipping steps that would be lost to quantization.
+ * The tables for that deadline are prepared in the process.
+ */
+static time_t get_commit_deadline(struct context *ctx, time_t now) {
+	const struct schedule_step *step = get_step(ctx, now);
+	const struct schedule_step *end = ctx->schedule + ctx->schedule_len;
+	for (step++; step < end; step++) {
+		if (prepare_tables(ctx, step)) {
+			return step->time;
+		}
+	}
+	return ctx->calc_day + 86400;
+}
+
+static bool output_takes_commit(struct output *output, bool dirty_only) {
+	return output_is_ready(output) && (!dirty_only || output->dirty);
+}
+
+/*
+ * Commits the given temperature to all outputs, or only to those whose gamma
+ * control became ready since the last commit if dirty_only is set.
+ */
+static void set_temperature(struct context *ctx,
+		const struct schedule_step *step, bool dirty_only) {
+	double start = ctx->config.timings ? get_monotonic_us() : 0;
+	ctx->commit_serial++;
+	int fills = 0, copies = 0, prepared = 0, unchanged = 0, commits = 0;
+	bool is_prepared = ctx->prepared_temp == step->temp;
+
+	// Distinct tables that were not prepared are filled first, possibly in
+	// parallel, and then copied to the outputs that share them.
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output_takes_commit(output, dirty_only)) {
+			continue;
+		}
+		output->commit_serial = ctx->commit_serial;
+		if (is_prepared && output->prepare_serial == ctx->prepare_serial) {
+			prepared++;
+		} else if (find_commit_twin(ctx, output) == NULL) {
+			add_fill_job(ctx, output, step);
+			fills++;
+		}
+	}
+	run_fill_jobs(ctx);
+
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output_takes_commit(output, dirty_only)) {
+			continue;
+		}
+		if (is_prepared && output->prepare_serial == ctx->prepare_serial) {
+			continue;
+		}
+		struct output *twin = find_commit_twin(ctx, output);
+		if (twin != NULL) {
+			memcpy(next_table(output)->data, next_table(twin)->data,
+					table_size(output));
+			copies++;
+		}
+	}
+
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (!output_takes_commit(output, dirty_only)) {
+			continue;
+		}
+		output->dirty = false;
+
+		struct gamma_table *table = next_table(output);
+		if (output->committed_table != NULL && memcmp(table->data,
+					output->committed_table->data,
+					table_size(output)) == 0) {
+			// The compositor already has this exact table
+			unchanged++;
+			continue;
+		}
+		output->committed_table = table;
+		output->next_table = (output->next_table + 1) % GAMMA_TABLE_BUFFERS;
+		output->prepare_serial = 0;
+
+		lseek(table->fd, 0, SEEK_SET);
 		zwlr_gamma_control_v1_set_gamma(output->gamma_control,
-				output->table_fd);
+				table->fd);
+		commits++;
 	}
+
+	if (ctx->config.timings) {
+		double end = get_monotonic_us();
+		histogram_add(&ctx->commit_time, end - start);
+		if (commits > 0 && ctx->flush_start == 0) {
+			ctx->flush_start = end;
+		}
+	}
+
+	ctx->committed_temp = step->temp;
+	ctx->table_fills += fills;
+	ctx->table_copies += copies;
+	fprintf(stderr, "setting temperature to %d K (%d tables computed, "
+			"%d reused, %d prepared, %d unchanged)\n", step->temp,
+			fills, copies, prepared, unchanged);
 }
 
-static int timer_fired = 0;
-static int timer_signal_fds[2];
+static void print_stats(struct context *ctx, FILE *f) {
+	fprintf(f, "%lu tables computed, %lu reused\n",
+			ctx->table_fills, ctx->table_copies);
+	if (!ctx->config.timings) {
+		fprintf(f, "timings are not recorded, see -H\n");
+		return;
+	}
+	histogram_print(&ctx->wake_lateness, f);
+	histogram_print(&ctx->commit_latency, f);
+	histogram_print(&ctx->commit_time, f);
+	histogram_print(&ctx->prepare_time, f);
+	histogram_print(&ctx->flush_time, f);
+}
+
+static const char *condition_name(enum sun_condition condition) {
+	switch (condition) {
+	case NORMAL:
+		return "normal";
+	case MIDNIGHT_SUN:
+		return "midnight_sun";
+	case POLAR_NIGHT:
+		return "polar_night";
+	default:
+		return "unknown";
+	}
+}
+
+static void print_status(struct context *ctx, FILE *f) {
+	const char *mode = ctx->forced_temp != 0 ? "forced" :
+		ctx->paused ? "paused" : "schedule";
+	fprintf(f, "temperature %d\nmode %s\n", ctx->committed_temp, mode);
+	if (!ctx->paused) {
+		const struct schedule_step *step = get_step(ctx, get_time_sec());
+		if (step + 1 < ctx->schedule + ctx->schedule_len) {
+			fprintf(f, "next %lld %d\n", (long long)step[1].time,
+					step[1].temp);
+		}
+	}
+
+	fprintf(f, "sun %s\n", condition_name(ctx->condition));
+	if (ctx->condition == NORMAL || ctx->state == STATE_TRANSITION) {
+		fprintf(f, "dawn %lld\nsunrise %lld\n", (long long)ctx->sun.dawn,
+				(long long)ctx->sun.sunrise);
+	}
+	if (ctx->condition == NORMAL) {
+		fprintf(f, "sunset %lld\ndusk %lld\n", (long long)ctx->sun.sunset,
+				(long long)ctx->sun.dusk);
+	}
+}
+
+/*
+ * Prints up to count steps of the schedule starting with the one in effect,
+ * which only covers the current day.
+ */
+static void print_schedule(struct context *ctx, int count, FILE *f) {
+	const struct schedule_step *step = get_step(ctx, get_time_sec());
+	const struct schedule_step *end = ctx->schedule + ctx->schedule_len;
+	for (; step < end && count > 0; step++, count--) {
+		fprintf(f, "%lld %d\n", (long long)step->time, step->temp);
+	}
+}
+
+static int parse_int(const char *s, int *value) {
+	char *end;
+	errno = 0;
+	long v = strtol(s, &end, 10);
+	if (errno != 0 || end == s || *end != '\0' || v < INT_MIN || v > INT_MAX) {
+		return -1;
+	}
+	*value = v;
+	return 0;
+}
+
+static int parse_double(const char *s, double *value) {
+	char *end;
+	errno = 0;
+	double v = strtod(s, &end);
+	if (errno != 0 || end == s || *end != '\0' || !isfinite(v)) {
+		return -1;
+	}
+	*value = v;
+	return 0;
+}
+
+/*
+ * A new location moves the sun and the day boundaries, so the stops are
+ * recalculated from scratch as on startup.
+ */
+static void reset_stops(struct context *ctx) {
+	ctx->state = STATE_INITIAL;
+	ctx->condition = SUN_CONDITION_LAST;
+	ctx->calc_day = 0;
+	ctx->longitude_time_offset = longitude_time_offset(ctx->config.longitude);
+}
+
+static const char *set_config(struct context *ctx, const char *key,
+		const char *value) {
+	struct config *cfg = &ctx->config;
+	if (strcmp(key, "high") == 0 || strcmp(key, "low") == 0) {
+		int temp;
+		if (parse_int(value, &temp) == -1 || !valid_temp(temp)) {
+			return "temperature must be between 1000 and 25000";
+		}
+		int high = key[0] == 'h' ? temp : cfg->high_temp;
+		int low = key[0] == 'l' ? temp : cfg->low_temp;
+		if (high <= low) {
+			return "high temp must be higher than low temp";
+		}
+		cfg->high_temp = high;
+		cfg->low_temp = low;
+
+		// The sun has not moved, only the steps between its stops
+		ctx->schedule_stale = true;
+	} else if (strcmp(key, "gamma") == 0) {
+		double gamma;
+		if (parse_double(value, &gamma) == -1 || gamma <= 0.0) {
+			return "gamma must be a positive number";
+		}
+		cfg->gamma = gamma;
+	} else if (strcmp(key, "latitude") == 0 ||
+			strcmp(key, "longitude") == 0) {
+		if (cfg->manual_time) {
+			return "latitude and longitude are not valid in manual time mode";
+		}
+		bool lat = strcmp(key, "latitude") == 0;
+		double degrees;
+		if (parse_double(value, &degrees) == -1 ||
+				fabs(degrees) > (lat ? 90.0 : 180.0)) {
+			return lat ? "latitude must be in interval [-90,90]" :
+				"longitude must be in interval [-180,180]";
+		}
+		if (lat) {
+			cfg->latitude = RADIANS(degrees);
+		} else {
+			cfg->longitude = RADIANS(degrees);
+		}
+		reset_stops(ctx);
+	} else {
+		return "unknown setting";
+	}
+	return NULL;
+}
+
+static void handle_control(void *data, char *line, FILE *reply) {
+	struct context *ctx = data;
+	char *save = NULL;
+	const char *cmd = strtok_r(line, " \t", &save);
+	const char *arg = strtok_r(NULL, " \t", &save);
+	const char *value = strtok_r(NULL, " \t", &save);
+
+	const char *error = NULL;
+	if (cmd == NULL) {
+		error = "empty command";
+	} else if (strcmp(cmd, "set") == 0 && value != NULL) {
+		error = set_config(ctx, arg, value);
+	} else if (strcmp(cmd, "force") == 0 && arg != NULL) {
+		int temp;
+		if (parse_int(arg, &temp) == -1 || !valid_temp(temp)) {
+			error = "temperature must be between 1000 and 25000";
+		} else {
+			ctx->forced_temp = temp;
+			ctx->paused = true;
+		}
+	} else if (strcmp(cmd, "pause") == 0) {
+		ctx->paused = true;
+	} else if (strcmp(cmd, "resume") == 0) {
+		ctx->paused = false;
+		ctx->forced_temp = 0;
+	} else if (strcmp(cmd, "stats") == 0) {
+		fprintf(reply, "ok\n");
+		print_stats(ctx, reply);
+		return;
+	} else if (strcmp(cmd, "status") == 0) {
+		// A set earlier in the same batch may have reset the stops
+		sync_schedule(ctx, get_time_sec());
+		fprintf(reply, "ok\n");
+		print_status(ctx, reply);
+		return;
+	} else if (strcmp(cmd, "schedule") == 0) {
+		int count = 16;
+		if (arg != NULL && (parse_int(arg, &count) == -1 || count < 1)) {
+			error = "count must be a positive number";
+		} else {
+			sync_schedule(ctx, get_time_sec());
+			fprintf(reply, "ok\n");
+			print_schedule(ctx, count, reply);
+			return;
+		}
+	} else {
+		error = "unknown command";
+	}
+
+	if (error != NULL) {
+		fprintf(reply, "error: %s\n", error);
+		return;
+	}
+	ctx->reconfigured = true;
+	fprintf(reply, "ok\n");
+}
+
+static int read_timer(struct context *ctx) {
+	// ECANCELED means that the clock was set, which we handle as if the
+	// timer fired to re-evaluate and rearm.
+	uint64_t expirations;
+	if (read(ctx->timer_fd, &expirations, sizeof expirations) == -1) {
+		if (errno == ECANCELED) {
+			ctx->timer_fired = true;
+		} else if (errno != EAGAIN) {
+			return -1;
+		}
+	} else {
+		ctx->timer_fired = true;
+	}
+	return 0;
+}
+
+static int read_signals(struct context *ctx) {
+	unsigned char signals[16];
+	ssize_t n;
+	while ((n = read(ctx->signal_fd, signals, sizeof signals)) > 0) {
+		for (ssize_t i = 0; i < n; i++) {
+			if (signals[i] == SIGUSR1) {
+				ctx->stats_requested = true;
+			} else {
+				ctx->quit_requested = true;
+			}
+		}
+	}
+	if (n == -1 && errno != EAGAIN) {
+		fprintf(stderr, "could not read signals: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
 
-static int display_dispatch(struct wl_display *display, int timeout) {
+static int display_dispatch(struct context *ctx, struct wl_display *display,
+		int timeout) {
 	if (wl_display_prepare_read(display) == -1) {
 		return wl_display_dispatch_pending(display);
 	}
 
-	struct pollfd pfd[2];
+	struct pollfd pfd[4 + CONTROL_POLLFDS];
 	pfd[0].fd = wl_display_get_fd(display);
-	pfd[1].fd = timer_signal_fds[0];
+	pfd[1].fd = ctx->timer_fd;
+	pfd[2].fd = ctx->hotplug_timer_fd;
+	pfd[3].fd = ctx->signal_fd;
 
 	pfd[0].events = POLLOUT;
 	while (wl_display_flush(display) == -1) {
@@ -554,24 +1314,48 @@ static int display_dispatch(struct wl_display *display, int timeout) {
 		}
 	}
 
+	if (ctx->flush_start != 0) {
+		histogram_add(&ctx->flush_time,
+				get_monotonic_us() - ctx->flush_start);
+		ctx->flush_start = 0;
+	}
+
+	// A signal returns to the caller, which may have work to do for it
 	pfd[0].events = POLLIN;
 	pfd[1].events = POLLIN;
-	while (poll(pfd, 2, timeout) == -1) {
-		if (errno != EINTR) {
-			wl_display_cancel_read(display);
-			return -1;
-		}
+	pfd[2].events = POLLIN;
+	pfd[3].events = POLLIN;
+	control_fill_pollfds(ctx->control, &pfd[4]);
+	if (poll(pfd, 4 + CONTROL_POLLFDS, timeout) == -1) {
+		wl_display_cancel_read(display);
+		return errno == EINTR ? 0 : -1;
 	}
 
-	if (pfd[1].revents & POLLIN) {
-		// Empty signal fd
-		char garbage[8];
-		if (read(timer_signal_fds[0], &garbage, sizeof garbage) == -1
-				&& errno != EAGAIN) {
-			return -1;
+	if ((pfd[1].revents & POLLIN) && read_timer(ctx) == -1) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	if (pfd[2].revents & POLLIN) {
+		uint64_t expirations;
+		if (read(ctx->hotplug_timer_fd, &expirations,
+					sizeof expirations) == -1) {
+			if (errno != EAGAIN) {
+				wl_display_cancel_read(display);
+				return -1;
+			}
+		} else {
+			ctx->hotplug_timer_fired = true;
 		}
 	}
 
+	if ((pfd[3].revents & POLLIN) && read_signals(ctx) == -1) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	control_dispatch(ctx->control, &pfd[4], handle_control, ctx);
+
 	if ((pfd[0].revents & POLLIN) == 0) {
 		wl_display_cancel_read(display);
 		return 0;
@@ -584,75 +1368,208 @@ static int display_dispatch(struct wl_display *display, int timeout) {
 	return wl_display_dispatch_pending(display);
 }
 
-static void timer_signal(int signal) {
-	(void)signal;
-	timer_fired = true;
-	if (write(timer_signal_fds[1], "\0", 1) == -1 && errno != EAGAIN) {
-		// This is unfortunate.
+static int setup_timer(struct context *ctx) {
+	ctx->timer_fd = timerfd_create(CLOCK_REALTIME,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctx->timer_fd == -1) {
+		fprintf(stderr, "could not configure timer: %s\n",
+				strerror(errno));
+		return -1;
 	}
-}
-
-static int set_nonblock(int fd) {
-	int flags;
-	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
-			fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+	ctx->hotplug_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctx->hotplug_timer_fd == -1) {
+		fprintf(stderr, "could not configure hotplug timer: %s\n",
+				strerror(errno));
 		return -1;
 	}
 	return 0;
 }
 
-static int setup_timer(struct context *ctx) {
-	struct sigaction timer_action = {
-		.sa_handler = timer_signal,
-		.sa_flags = 0,
-	};
-	if (pipe(timer_signal_fds) == -1) {
+static int signal_pipe = -1;
+
+static void handle_signal(int signal) {
+	// A full pipe already wakes the main loop, so the write may fail
+	int saved_errno = errno;
+	unsigned char byte = signal;
+	ssize_t ret = write(signal_pipe, &byte, 1);
+	(void)ret;
+	errno = saved_errno;
+}
+
+static int setup_signals(struct context *ctx) {
+	int fds[2];
+	if (pipe(fds) == -1) {
 		fprintf(stderr, "could not create signal pipe: %s\n",
 				strerror(errno));
 		return -1;
 	}
-	if (set_nonblock(timer_signal_fds[0]) == -1 ||
-			set_nonblock(timer_signal_fds[1]) == -1) {
-		fprintf(stderr, "could not set nonblock on signal pipe: %s\n",
-				strerror(errno));
-		return -1;
-	}
-	if (sigaction(SIGALRM, &timer_action, NULL) == -1) {
-		fprintf(stderr, "could not configure alarm handler: %s\n",
-				strerror(errno));
-		return -1;
+	for (int i = 0; i < 2; i++) {
+		if (fcntl(fds[i], F_SETFD, FD_CLOEXEC) == -1 ||
+				fcntl(fds[i], F_SETFL, O_NONBLOCK) == -1) {
+			fprintf(stderr, "could not configure signal pipe: %s\n",
+					strerror(errno));
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+		}
 	}
-	if (timer_create(CLOCK_REALTIME, NULL, &ctx->timer) == -1) {
-		fprintf(stderr, "could not configure timer: %s\n",
+	ctx->signal_fd = fds[0];
+	signal_pipe = fds[1];
+
+	// No SA_RESTART, so that the signal interrupts poll
+	struct sigaction action = {
+		.sa_handler = handle_signal,
+	};
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGUSR1, &action, NULL) == -1 ||
+			sigaction(SIGINT, &action, NULL) == -1 ||
+			sigaction(SIGTERM, &action, NULL) == -1) {
+		fprintf(stderr, "could not set up signal handler: %s\n",
 				strerror(errno));
 		return -1;
 	}
 	return 0;
 }
 
-static int wlrun(struct config cfg) {
+static void setup_pending_outputs(struct context *ctx) {
+	ctx->outputs_pending = false;
+	struct output *output;
+	wl_list_for_each(output, &ctx->outputs, link) {
+		if (output->needs_setup) {
+			output->needs_setup = false;
+			setup_output(output);
+		}
+	}
+}
+
+static void handle_pending_outputs(struct context *ctx) {
+	if (ctx->hotplug_timer_fired) {
+		ctx->hotplug_timer_fired = false;
+		ctx->hotplug_timer_armed = false;
+		setup_pending_outputs(ctx);
+	}
+	if (!ctx->outputs_pending || ctx->hotplug_timer_armed) {
+		return;
+	}
+	if (ctx->config.hotplug_delay <= 0) {
+		setup_pending_outputs(ctx);
+		return;
+	}
 
-	// Initialize defaults
-	struct context ctx = {
+	struct itimerspec timerspec = {
+		.it_interval = {0},
+		.it_value = {
+			.tv_sec = ctx->config.hotplug_delay / 1000,
+			.tv_nsec = (ctx->config.hotplug_delay % 1000) * 1000000,
+		}
+	};
+	timerfd_settime(ctx->hotplug_timer_fd, 0, &timerspec, NULL);
+	ctx->hotplug_timer_armed = true;
+}
+
+/*
+ * Returns when to wake up next, which is only at the end of the day while
+ * paused.
+ */
+static time_t get_wakeup(struct context *ctx, time_t now) {
+	if (ctx->paused) {
+		return ctx->calc_day + 86400;
+	}
+	return get_commit_deadline(ctx, now);
+}
+
+/*
+ * Follows the schedule once the timer fired or the realtime clock was set,
+ * and rearms the timer for the next deadline. step is the step in effect and
+ * deadline the time the timer was armed for, both updated.
+ */
+static void handle_timer(struct context *ctx, struct schedule_step *step,
+		time_t *deadline) {
+	bool timings = ctx->config.timings;
+
+	// A clock change also wakes us, possibly early
+	double lateness = get_time_ms_since(*deadline);
+	if (timings && lateness >= 0) {
+		histogram_add(&ctx->wake_lateness, lateness * 1000);
+	}
+
+	time_t now = get_time_sec();
+	recalc_stops(ctx, now);
+
+	const struct schedule_step *next = get_step(ctx, now);
+	if (!ctx->paused && next->temp != step->temp) {
+		*step = *next;
+		ctx->new_output = false;
+		set_temperature(ctx, step, false);
+		double latency = get_time_ms_since(*deadline);
+		if (timings && latency >= 0) {
+			histogram_add(&ctx->commit_latency, latency * 1000);
+		}
+	}
+
+	double start = timings ? get_monotonic_us() : 0;
+	*deadline = get_wakeup(ctx, now);
+	if (timings) {
+		histogram_add(&ctx->prepare_time, get_monotonic_us() - start);
+	}
+	update_timer(ctx->timer_fd, *deadline);
+}
+
+static void init_context(struct context *ctx, struct config cfg) {
+	*ctx = (struct context){
 		.sun = { 0 },
 		.condition = SUN_CONDITION_LAST,
 		.state = STATE_INITIAL,
 		.config = cfg,
+		.prepared_temp = -1,
+		.signal_fd = -1,
+		.wake_lateness = { .name = "wake lateness" },
+		.commit_latency = { .name = "deadline to commit" },
+		.commit_time = { .name = "commit compute time" },
+		.prepare_time = { .name = "prepare compute time" },
+		.flush_time = { .name = "commit to flush" },
 	};
 	if (!cfg.manual_time) {
-		ctx.longitude_time_offset = longitude_time_offset(cfg.longitude);
+		ctx->longitude_time_offset = longitude_time_offset(cfg.longitude);
 	}
 
-	wl_list_init(&ctx.outputs);
+	wl_list_init(&ctx->outputs);
+}
 
-	if (setup_timer(&ctx) == -1) {
-		return EXIT_FAILURE;
+static int wlrun(struct config cfg) {
+	struct context ctx;
+	init_context(&ctx, cfg);
+
+	if (cfg.fill_threads > 1) {
+		ctx.fill_pool = fill_pool_create(cfg.fill_threads - 1);
+		if (ctx.fill_pool == NULL) {
+			fprintf(stderr, "could not create fill threads, "
+					"filling gamma tables on the main thread\n");
+		}
+	}
+
+	int ret = EXIT_FAILURE;
+	struct wl_display *display = NULL;
+	if (setup_timer(&ctx) == -1 || setup_signals(&ctx) == -1) {
+		goto out;
+	}
+
+	if (cfg.control_socket) {
+		char path[PATH_MAX];
+		if (control_socket_path(path, sizeof path) == -1) {
+			goto out;
+		}
+		ctx.control = control_create(path);
+		if (ctx.control == NULL) {
+			goto out;
+		}
 	}
 
-	struct wl_display *display = wl_display_connect(NULL);
+	display = wl_display_connect(NULL);
 	if (display == NULL) {
 		fprintf(stderr, "failed to create display\n");
-		return EXIT_FAILURE;
+		goto out;
 	}
 
 	struct wl_registry *registry = wl_display_get_registry(display);
@@ -661,46 +1578,274 @@ static int wlrun(struct config cfg) {
 
 	if (gamma_control_manager == NULL) {
 		fprintf(stderr, "compositor doesn't support wlr-gamma-control-unstable-v1\n");
-		return EXIT_FAILURE;
+		goto out;
 	}
 
-	struct output *output;
-	wl_list_for_each(output, &ctx.outputs, link) {
-		setup_output(output);
-	}
+	setup_pending_outputs(&ctx);
 	wl_display_roundtrip(display);
 
 	time_t now = get_time_sec();
 	recalc_stops(&ctx, now);
-	update_timer(&ctx, ctx.timer, now);
-
-	int temp = get_temperature(&ctx, now);
-	set_temperature(&ctx.outputs, temp, ctx.config.gamma);
 
-	int old_temp = temp;
-	while (display_dispatch(display, -1) != -1) {
-		if (timer_fired) {
-			timer_fired = false;
+	struct schedule_step step = *get_step(&ctx, now);
+	ctx.new_output = false;
+	set_temperature(&ctx, &step, false);
+	time_t deadline = get_commit_deadline(&ctx, now);
+	update_timer(ctx.timer_fd, deadline);
 
+	while (!ctx.quit_requested && display_dispatch(&ctx, display, -1) != -1) {
+		if (ctx.timer_fired) {
+			ctx.timer_fired = false;
+			handle_timer(&ctx, &step, &deadline);
+		}
+		if (ctx.new_output) {
+			// New outputs may need steps that were skipped for others
+			ctx.new_output = false;
+			set_temperature(&ctx, &step, true);
+			now = get_time_sec();
+			deadline = get_wakeup(&ctx, now);
+			update_timer(ctx.timer_fd, deadline);
+		}
+		if (ctx.reconfigured) {
+			ctx.reconfigured = false;
 			now = get_time_sec();
-			recalc_stops(&ctx, now);
-			update_timer(&ctx, ctx.timer, now);
-
-			if ((temp = get_temperature(&ctx, now)) != old_temp) {
-				old_temp = temp;
-				ctx.new_output = false;
-				set_temperature(&ctx.outputs, temp,
-						ctx.config.gamma);
+			sync_schedule(&ctx, now);
+
+			if (ctx.forced_temp != 0) {
+				step = (struct schedule_step){
+					.time = now,
+					.temp = ctx.forced_temp,
+				};
+				calc_whitepoint(step.temp, &step.rw, &step.gw,
+						&step.bw);
+			} else if (!ctx.paused) {
+				step = *get_step(&ctx, now);
 			}
-		} else if (ctx.new_output) {
+
+			// Prepared tables may be for an old schedule or gamma.
+			// Tables that come out the same are not sent again.
+			ctx.prepared_temp = -1;
 			ctx.new_output = false;
-			set_temperature(&ctx.outputs, temp, ctx.config.gamma);
+			set_temperature(&ctx, &step, false);
+			deadline = get_wakeup(&ctx, now);
+			update_timer(ctx.timer_fd, deadline);
+		}
+		handle_pending_outputs(&ctx);
+		if (ctx.stats_requested) {
+			ctx.stats_requested = false;
+			print_stats(&ctx, stderr);
 		}
 	}
+	ret = EXIT_SUCCESS;
 
+out:
+	// Disconnecting makes the compositor restore the gamma of our outputs
+	if (display != NULL) {
+		wl_display_disconnect(display);
+	}
+	control_destroy(ctx.control);
+	if (ctx.fill_pool != NULL) {
+		fill_pool_destroy(ctx.fill_pool);
+	}
+	return ret;
+}
+
+/*
+ * Runs the schedule against a virtual clock that jumps straight from deadline
+ * to deadline, printing every temperature that would have been committed.
+ */
+static int simrun(struct config cfg, time_t start, int days) {
+	struct context ctx;
+	init_context(&ctx, cfg);
+
+	time_t end = start + (time_t)days * 86400;
+	unsigned long wakeups = 0, commits = 0;
+	int old_temp = -1;
+	for (time_t now = start; now < end; wakeups++) {
+		recalc_stops(&ctx, now);
+
+		const struct schedule_step *step = get_step(&ctx, now);
+		if (step->temp != old_temp) {
+			old_temp = step->temp;
+			commits++;
+
+			struct tm tm;
+			localtime_r(&now, &tm);
+			printf("%04d-%02d-%02d %02d:%02d:%02d %d %.4f %.4f %.4f\n",
+					tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+					tm.tm_hour, tm.tm_min, tm.tm_sec, step->temp,
+					step->rw, step->gw, step->bw);
+		}
+
+		now = get_deadline(&ctx, now);
+	}
+
+	fprintf(stderr, "simulated %d days: %lu wakeups, %lu commits "
+			"(%.1f wakeups per day)\n", days, wakeups, commits,
+			(double)wakeups / days);
+	return EXIT_SUCCESS;
+}
+
+struct site {
+	double latitude;
+	double longitude;
+};
+
+struct ephemeris_date {
+	struct sun_day sun;
+	char label[16];
+};
+
+/*
+ * Reads sites as one "latitude longitude" pair in degrees per line, skipping
+ * empty lines and lines starting with #.
+ */
+static int read_sites(FILE *f, struct site **sites, size_t *count) {
+	size_t cap = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	int lineno = 0;
+	*sites = NULL;
+	*count = 0;
+	while (getline(&line, &line_size, f) != -1) {
+		lineno++;
+		char *p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '\n' || *p == '#') {
+			continue;
+		}
+
+		struct site site;
+		if (sscanf(p, "%lf %lf", &site.latitude, &site.longitude) != 2 ||
+				fabs(site.latitude) > 90.0 ||
+				fabs(site.longitude) > 180.0) {
+			fprintf(stderr, "invalid site on line %d, expected "
+					"latitude and longitude\n", lineno);
+			goto error;
+		}
+
+		if (*count == cap) {
+			cap = cap ? cap * 2 : 64;
+			struct site *new_sites = realloc(*sites, cap * sizeof *new_sites);
+			if (new_sites == NULL) {
+				fprintf(stderr, "could not allocate sites\n");
+				goto error;
+			}
+			*sites = new_sites;
+		}
+		(*sites)[(*count)++] = site;
+	}
+	free(line);
+	return 0;
+
+error:
+	free(line);
+	free(*sites);
+	*sites = NULL;
+	return -1;
+}
+
+/*
+ * Prints the sun of each site for a number of days as CSV, with times in
+ * seconds since the epoch. Each day is the solar day of the site, as used by
+ * the schedule. The terms that only depend on the date are computed once for
+ * all sites, and those that only depend on the latitude once for all days.
+ */
+static int ephemeris(struct config cfg, time_t start, int days) {
+	struct site single, *sites = &single;
+	size_t count = 1;
+	if (isnan(cfg.latitude) || isnan(cfg.longitude)) {
+		if (read_sites(stdin, &sites, &count) == -1) {
+			return EXIT_FAILURE;
+		}
+	} else {
+		single = (struct site){
+			.latitude = DEGREES(cfg.latitude),
+			.longitude = DEGREES(cfg.longitude),
+		};
+	}
+
+	// Days are counted from the UTC midnight of the start date, and the
+	// solar day of a site east of Greenwich starts on the UTC date before
+	// it, so one more date than days is needed.
+	struct tm start_tm;
+	localtime_r(&start, &start_tm);
+	start_tm.tm_hour = start_tm.tm_min = start_tm.tm_sec = 0;
+	start_tm.tm_isdst = 0;
+	time_t first = timegm(&start_tm) - 86400;
+	struct ephemeris_date *dates = calloc(days + 2, sizeof *dates);
+	if (dates == NULL) {
+		fprintf(stderr, "could not allocate dates\n");
+		if (sites != &single) {
+			free(sites);
+		}
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < days + 2; i++) {
+		time_t date = first + (time_t)i * 86400;
+		struct tm tm;
+		gmtime_r(&date, &tm);
+		calc_sun_day(&tm, SUN_MODEL_FAST, &dates[i].sun);
+		strftime(dates[i].label, sizeof dates[i].label, "%Y-%m-%d", &tm);
+	}
+
+	printf("date,latitude,longitude,condition,dawn,sunrise,sunset,dusk\n");
+	for (size_t i = 0; i < count; i++) {
+		struct sun_site site;
+		calc_sun_site(RADIANS(sites[i].latitude), &site);
+		time_t offset = longitude_time_offset(RADIANS(sites[i].longitude));
+		char location[64];
+		snprintf(location, sizeof location, "%g,%g", sites[i].latitude,
+				sites[i].longitude);
+
+		for (int d = 0; d < days; d++) {
+			time_t day = first + (time_t)(d + 1) * 86400 - offset;
+			const struct sun_day *date = &dates[(day - first) / 86400].sun;
+
+			// The precise model also depends on the time of day at
+			// which the day of the site starts
+			struct sun_day precise;
+			if (cfg.sun_model == SUN_MODEL_PRECISE) {
+				struct tm tm;
+				gmtime_r(&day, &tm);
+				calc_sun_day(&tm, SUN_MODEL_PRECISE, &precise);
+				date = &precise;
+			}
+
+			struct sun sun;
+			enum sun_condition cond = calc_sun_at(date, &site, &sun);
+
+			printf("%s,%s,%s", dates[d + 1].label, location,
+					condition_name(cond));
+			if (cond == NORMAL) {
+				printf(",%lld,%lld,%lld,%lld\n",
+						(long long)(day + sun.dawn),
+						(long long)(day + sun.sunrise),
+						(long long)(day + sun.sunset),
+						(long long)(day + sun.dusk));
+			} else {
+				printf(",,,,\n");
+			}
+		}
+	}
+
+	free(dates);
+	if (sites != &single) {
+		free(sites);
+	}
 	return EXIT_SUCCESS;
 }
 
+static int parse_date(const char *s, time_t *time) {
+	struct tm tm = { 0 };
+
+	if (strptime(s, "%Y-%m-%d", &tm) == NULL) {
+		return -1;
+	}
+	tm.tm_isdst = -1;
+	*time = mktime(&tm);
+	return *time == -1 ? -1 : 0;
+}
+
 static int parse_time_of_day(const char *s, time_t *time) {
 	struct tm tm = { 0 };
 
@@ -723,16 +1868,25 @@ static const char usage[] = "usage: %s [options]\n"
 "  -T <temp>      set high temperature (default: 6500)\n"
 "  -l <lat>       set latitude (e.g. 39.9)\n"
 "  -L <long>      set longitude (e.g. 116.3)\n"
+"  -m <model>     set sun model, fast or precise (default: fast)\n"
+"  -e             follow the elevation of the sun between dawn and sunrise\n"
+"  -k <curve>     set transition curve, linear, mired, smoothstep, sigmoid\n"
+"                 or a file of points (default: linear)\n"
 "  -S <sunrise>   set manual sunrise (e.g. 06:30)\n"
 "  -s <sunset>    set manual sunset (e.g. 18:30)\n"
 "  -d <duration>  set manual duration in seconds (e.g. 1800)\n"
-"  -g <gamma>     set gamma (default: 1.0)\n";
+"  -g <gamma>     set gamma (default: 1.0)\n"
+"  -w <delay>     set output hotplug batching delay in ms (default: 100)\n"
+"  -j <threads>   set number of threads filling gamma tables (default: 1)\n"
+"  -H             record timing histograms for SIGUSR1 and stats\n"
+"  -c             listen for commands on a control socket\n"
+"  -C <command>   send a command to a running instance and exit\n"
+"  -n <days>      simulate the schedule for a number of days and exit\n"
+"  -E <days>      print the sun for a number of days as CSV and exit\n"
+"  -N <date>      set start date for -n and -E (e.g. 2021-06-21, default: now)\n";
 
 int main(int argc, char *argv[]) {
-#ifdef SPEEDRUN
-	fprintf(stderr, "warning: speedrun mode enabled\n");
-#endif
-	init_time();
+	tzset();
 
 	struct config config = {
 		.latitude = NAN,
@@ -740,10 +1894,17 @@ int main(int argc, char *argv[]) {
 		.high_temp = 6500,
 		.low_temp = 4000,
 		.gamma = 1.0,
+		.hotplug_delay = 100,
+		.fill_threads = 1,
 	};
+	int simulate_days = 0;
+	int ephemeris_days = 0;
+	time_t simulate_start = get_time_sec();
+	const char *control_command = NULL;
+	int ret = EXIT_FAILURE;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hvt:T:l:L:S:s:d:g:")) != -1) {
+	while ((opt = getopt(argc, argv, "hvt:T:l:L:m:ek:S:s:d:g:w:j:HcC:n:E:N:")) != -1) {
 		switch (opt) {
 			case 't':
 				config.low_temp = strtol(optarg, NULL, 10);
@@ -757,17 +1918,50 @@ int main(int argc, char *argv[]) {
 			case 'L':
 				config.longitude = strtod(optarg, NULL);
 				break;
+			case 'm':
+				if (strcmp(optarg, "fast") == 0) {
+					config.sun_model = SUN_MODEL_FAST;
+				} else if (strcmp(optarg, "precise") == 0) {
+					config.sun_model = SUN_MODEL_PRECISE;
+				} else {
+					fprintf(stderr, "invalid sun model, expected fast or precise, got %s\n", optarg);
+					goto out;
+				}
+				break;
+			case 'e':
+				config.elevation = true;
+				break;
+			case 'k':
+				if (strcmp(optarg, "linear") == 0) {
+					config.curve = EASING_LINEAR;
+				} else if (strcmp(optarg, "mired") == 0) {
+					config.curve = EASING_MIRED;
+				} else if (strcmp(optarg, "smoothstep") == 0) {
+					config.curve = EASING_SMOOTHSTEP;
+				} else if (strcmp(optarg, "sigmoid") == 0) {
+					config.curve = EASING_SIGMOID;
+				} else {
+					// A later -k replaces an earlier points file
+					free(config.curve_points);
+					config.curve_points = NULL;
+					if (easing_load_points(optarg, &config.curve_points,
+								&config.curve_points_len) != 0) {
+						goto out;
+					}
+					config.curve = EASING_POINTS;
+				}
+				break;
 			case 'S':
 				if (parse_time_of_day(optarg, &config.sunrise) != 0) {
 					fprintf(stderr, "invalid time, expected HH:MM, got %s\n", optarg);
-					return EXIT_FAILURE;
+					goto out;
 				}
 				config.manual_time = true;
 				break;
 			case 's':
 				if (parse_time_of_day(optarg, &config.sunset) != 0) {
 					fprintf(stderr, "invalid time, expected HH:MM, got %s\n", optarg);
-					return EXIT_FAILURE;
+					goto out;
 				}
 				config.manual_time = true;
 				break;
@@ -777,40 +1971,106 @@ int main(int argc, char *argv[]) {
 			case 'g':
 				config.gamma = strtod(optarg, NULL);
 				break;
+			case 'w':
+				config.hotplug_delay = strtol(optarg, NULL, 10);
+				break;
+			case 'j':
+				config.fill_threads = strtol(optarg, NULL, 10);
+				break;
+			case 'H':
+				config.timings = true;
+				break;
+			case 'c':
+				config.control_socket = true;
+				break;
+			case 'C':
+				control_command = optarg;
+				break;
+			case 'n':
+				simulate_days = strtol(optarg, NULL, 10);
+				break;
+			case 'E':
+				ephemeris_days = strtol(optarg, NULL, 10);
+				break;
+			case 'N':
+				if (parse_date(optarg, &simulate_start) != 0) {
+					fprintf(stderr, "invalid date, expected YYYY-MM-DD, got %s\n", optarg);
+					goto out;
+				}
+				break;
 			case 'v':
 				printf("wlsunset version %s\n", WLSUNSET_VERSION);
-				return EXIT_SUCCESS;
+				ret = EXIT_SUCCESS;
+				goto out;
 			case 'h':
 			default:
 				fprintf(stderr, usage, argv[0]);
-				return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+				ret = opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+				goto out;
 		}
 	}
 
+	if (control_command != NULL) {
+		char path[PATH_MAX];
+		if (control_socket_path(path, sizeof path) == -1) {
+			goto out;
+		}
+		ret = control_request(path, control_command) == 0 ?
+			EXIT_SUCCESS : EXIT_FAILURE;
+		goto out;
+	}
+
+	if (!valid_temp(config.high_temp) || !valid_temp(config.low_temp)) {
+		fprintf(stderr, "temperatures must be between %d and %d\n",
+				MIN_TEMP, MAX_TEMP);
+		goto out;
+	}
 	if (config.high_temp <= config.low_temp) {
 		fprintf(stderr, "high temp (%d) must be higher than low (%d) temp\n",
 				config.high_temp, config.low_temp);
-		return EXIT_FAILURE;
+		goto out;
 	}
 	if (config.manual_time) {
+		if (config.elevation) {
+			fprintf(stderr, "elevation mode is not valid in manual time mode\n");
+			goto out;
+		}
 		if (!isnan(config.latitude) || !isnan(config.longitude)) {
 			fprintf(stderr, "latitude and longitude are not valid in manual time mode\n");
-			return EXIT_FAILURE;
+			goto out;
 		}
 	} else {
 		if (config.latitude > 90.0 || config.latitude < -90.0) {
 			fprintf(stderr, "latitude (%lf) must be in interval [-90,90]\n",
 					config.latitude);
-			return EXIT_FAILURE;
+			goto out;
 		}
 		config.latitude = RADIANS(config.latitude);
 		if (config.longitude > 180.0 || config.longitude < -180.0) {
 			fprintf(stderr, "longitude (%lf) must be in interval [-180,180]\n",
 					config.longitude);
-			return EXIT_FAILURE;
+			goto out;
 		}
 		config.longitude = RADIANS(config.longitude);
 	}
 
-	return wlrun(config);
+	if (ephemeris_days > 0) {
+		if (config.manual_time) {
+			fprintf(stderr, "ephemeris is not available in manual time mode\n");
+			goto out;
+		}
+		if (isnan(config.latitude) != isnan(config.longitude)) {
+			fprintf(stderr, "ephemeris needs both latitude and longitude, or neither to read sites from stdin\n");
+			goto out;
+		}
+		ret = ephemeris(config, simulate_start, ephemeris_days);
+	} else if (simulate_days > 0) {
+		ret = simrun(config, simulate_start, simulate_days);
+	} else {
+		ret = wlrun(config);
+	}
+
+out:
+	free(config.curve_points);
+	return ret;
 }
@@ -0,0 +1,335 @@
+/*
+ * Micro-benchmarks, run with `meson test --benchmark`. Each suite prints one
+ * line per case with the average time and heap allocations per call.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "color_math.c"
+#include "fill_pool.h"
+
+/*
+ * Heap allocations are counted by wrapping the allocator at link time with
+ * --wrap, which catches the calls of every object linked into the benchmark,
+ * fill_pool.c included, but not those made inside libc itself.
+ */
+static _Atomic uint64_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	allocations++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+// Results are accumulated here so that the calls are not optimized out
+static volatile double sink;
+
+static uint64_t start_time, start_allocations;
+
+static uint64_t now_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void begin(void) {
+	start_allocations = allocations;
+	start_time = now_nsec();
+}
+
+static void end(const char *name, uint64_t ops) {
+	uint64_t elapsed = now_nsec() - start_time;
+	printf("%-40s %12.1f ns/op %8.2f allocs/op\n", name,
+			(double)elapsed / ops,
+			(double)(allocations - start_allocations) / ops);
+}
+
+// fill_gamma_table as it was before the whitepoint was factored out
+static void fill_gamma_table_reference(uint16_t *table, uint32_t ramp_size,
+		double rw, double gw, double bw, double gamma) {
+	uint16_t *r = table;
+	uint16_t *g = table + ramp_size;
+	uint16_t *b = table + 2 * ramp_size;
+	for (uint32_t i = 0; i < ramp_size; ++i) {
+		double val = (double)i / (ramp_size - 1);
+		r[i] = (uint16_t)(UINT16_MAX * pow(val * rw, 1.0 / gamma));
+		g[i] = (uint16_t)(UINT16_MAX * pow(val * gw, 1.0 / gamma));
+		b[i] = (uint16_t)(UINT16_MAX * pow(val * bw, 1.0 / gamma));
+	}
+}
+
+typedef void (*fill_func)(uint16_t *table, uint32_t ramp_size,
+		double rw, double gw, double bw, double gamma);
+
+static void bench_fill(void) {
+	const uint32_t sizes[] = { 256, 1024, 4096, 65536 };
+	const double gammas[] = { 1.0, 0.8, 2.2 };
+	const struct {
+		const char *name;
+		fill_func fill;
+	} impls[] = {
+		{ "reference", fill_gamma_table_reference },
+		{ "fill_gamma_table", fill_gamma_table },
+	};
+
+	for (size_t s = 0; s < sizeof sizes / sizeof *sizes; s++) {
+		uint32_t size = sizes[s];
+		uint16_t *table = malloc(size * 3 * sizeof *table);
+		if (table == NULL) {
+			abort();
+		}
+		// Keep the total work per case roughly constant
+		uint64_t ops = 4 * 1024 * 1024 / size;
+
+		for (size_t n = 0; n < sizeof gammas / sizeof *gammas; n++) {
+			for (size_t k = 0; k < sizeof impls / sizeof *impls; k++) {
+				begin();
+				for (uint64_t op = 0; op < ops; op++) {
+					double rw, gw, bw;
+					calc_whitepoint(1000 + (op * 100) % 24000, &rw, &gw, &bw);
+					impls[k].fill(table, size, rw, gw, bw, gammas[n]);
+				}
+				char name[64];
+				snprintf(name, sizeof name, "%s/%u/%.1f",
+						impls[k].name, size, gammas[n]);
+				end(name, ops);
+			}
+		}
+		free(table);
+	}
+}
+
+#define SUN_DAYS 365
+#define SUN_LATITUDES 33
+
+static void bench_sun(void) {
+	static struct sun_day days[SUN_DAYS];
+	static struct sun_site sites[SUN_LATITUDES];
+	const struct {
+		const char *name;
+		enum sun_model model;
+	} models[] = {
+		{ "fast", SUN_MODEL_FAST },
+		{ "precise", SUN_MODEL_PRECISE },
+	};
+
+	// Every 5 degrees from 80S to 80N, across both polar circles
+	uint64_t ops = 0;
+	begin();
+	for (int rep = 0; rep < 1000; rep++) {
+		for (int l = 0; l < SUN_LATITUDES; l++) {
+			calc_sun_site(RADIANS(-80.0 + l * 5.0), &sites[l]);
+			ops++;
+		}
+	}
+	end("calc_sun_site", ops);
+
+	for (size_t m = 0; m < sizeof models / sizeof *models; m++) {
+		char name[64];
+
+		ops = 0;
+		begin();
+		for (int rep = 0; rep < 100; rep++) {
+			for (int d = 0; d < SUN_DAYS; d++) {
+				struct tm tm = { .tm_year = 121, .tm_mday = 1, .tm_yday = d };
+				calc_sun_day(&tm, models[m].model, &days[d]);
+				ops++;
+			}
+		}
+		snprintf(name, sizeof name, "calc_sun_day/%s", models[m].name);
+		end(name, ops);
+
+		ops = 0;
+		begin();
+		for (int rep = 0; rep < 10; rep++) {
+			for (int d = 0; d < SUN_DAYS; d++) {
+				for (int l = 0; l < SUN_LATITUDES; l++) {
+					struct sun sun;
+					sink += calc_sun_at(&days[d], &sites[l], &sun);
+					sink += sun.sunrise;
+					ops++;
+				}
+			}
+		}
+		snprintf(name, sizeof name, "calc_sun_at/%s", models[m].name);
+		end(name, ops);
+
+		ops = 0;
+		begin();
+		for (int d = 0; d < SUN_DAYS; d += 7) {
+			for (int l = 0; l < SUN_LATITUDES; l++) {
+				struct sun_elevation_fit fit;
+				fit_sun_elevation(&days[d], &sites[l], &fit);
+				sink += fit.coeffs[0];
+				ops++;
+			}
+		}
+		snprintf(name, sizeof name, "fit_sun_elevation/%s", models[m].name);
+		end(name, ops);
+	}
+
+	struct sun_elevation_fit fit;
+	fit_sun_elevation(&days[172], &sites[SUN_LATITUDES / 2], &fit);
+	ops = 0;
+	begin();
+	for (int t = 0; t < 86400; t++) {
+		sink += eval_sun_elevation(&fit, t);
+		ops++;
+	}
+	end("eval_sun_elevation", ops);
+}
+
+static void bench_whitepoint(void) {
+	double rw, gw, bw;
+	uint64_t ops = 0;
+
+	// The first call fills the table, which is not part of the steady state
+	begin();
+	calc_whitepoint(6500, &rw, &gw, &bw);
+	end("calc_whitepoint/first", 1);
+
+	begin();
+	for (int rep = 0; rep < 100; rep++) {
+		for (int temp = WHITEPOINT_MIN_TEMP; temp <= WHITEPOINT_MAX_TEMP;
+				temp++) {
+			calc_whitepoint(temp, &rw, &gw, &bw);
+			sink += rw + gw + bw;
+			ops++;
+		}
+	}
+	end("calc_whitepoint", ops);
+
+	ops = 0;
+	begin();
+	for (int rep = 0; rep < 100; rep++) {
+		for (int temp = WHITEPOINT_MIN_TEMP; temp < WHITEPOINT_MAX_TEMP;
+				temp++) {
+			calc_whitepoint(temp + 0.37, &rw, &gw, &bw);
+			sink += rw + gw + bw;
+			ops++;
+		}
+	}
+	end("calc_whitepoint/fractional", ops);
+
+	ops = 0;
+	begin();
+	for (int temp = WHITEPOINT_MIN_TEMP; temp <= WHITEPOINT_MAX_TEMP; temp++) {
+		calc_whitepoint_exact(temp, &rw, &gw, &bw);
+		sink += rw + gw + bw;
+		ops++;
+	}
+	end("calc_whitepoint_exact", ops);
+}
+
+#define POOL_RAMP_SIZE 4096
+#define POOL_MAX_OUTPUTS 16
+
+/*
+ * One operation fills the tables of all outputs for a single step, as
+ * set_temperature does. A pool of 0 threads fills them on the calling thread.
+ */
+static void bench_pool(void) {
+	const int thread_counts[] = { 0, 1, 3, 7 };
+	const size_t output_counts[] = { 1, 2, 4, 8, 12, POOL_MAX_OUTPUTS };
+	const double gammas[] = { 1.0, 2.2 };
+	const uint64_t ops = 200;
+
+	uint16_t *tables = malloc(POOL_MAX_OUTPUTS * POOL_RAMP_SIZE * 3 *
+			sizeof *tables);
+	if (tables == NULL) {
+		abort();
+	}
+	struct fill_job jobs[POOL_MAX_OUTPUTS];
+
+	for (size_t t = 0; t < sizeof thread_counts / sizeof *thread_counts; t++) {
+		struct fill_pool *pool = NULL;
+		if (thread_counts[t] > 0) {
+			begin();
+			pool = fill_pool_create(thread_counts[t]);
+			if (pool == NULL) {
+				abort();
+			}
+			char name[64];
+			snprintf(name, sizeof name, "fill_pool_create/%d threads",
+					thread_counts[t]);
+			end(name, 1);
+		}
+
+		for (size_t g = 0; g < sizeof gammas / sizeof *gammas; g++) {
+			for (size_t n = 0; n < sizeof output_counts / sizeof *output_counts; n++) {
+				size_t outputs = output_counts[n];
+				begin();
+				for (uint64_t op = 0; op < ops; op++) {
+					double rw, gw, bw;
+					calc_whitepoint(1000 + (op * 100) % 24000, &rw, &gw, &bw);
+					for (size_t i = 0; i < outputs; i++) {
+						jobs[i] = (struct fill_job){
+							.table = tables + i * POOL_RAMP_SIZE * 3,
+							.ramp_size = POOL_RAMP_SIZE,
+							.rw = rw,
+							.gw = gw,
+							.bw = bw,
+							.gamma = gammas[g],
+						};
+					}
+					fill_pool_run(pool, jobs, outputs);
+				}
+				char name[64];
+				snprintf(name, sizeof name, "fill_pool/%d threads/%zu outputs/%.1f",
+						thread_counts[t], outputs, gammas[g]);
+				end(name, ops);
+			}
+		}
+
+		if (pool != NULL) {
+			fill_pool_destroy(pool);
+		}
+	}
+	free(tables);
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} suites[] = {
+	{ "sun", bench_sun },
+	{ "whitepoint", bench_whitepoint },
+	{ "fill", bench_fill },
+	{ "pool", bench_pool },
+};
+
+int main(int argc, char *argv[]) {
+	int ran = 0;
+	for (size_t i = 0; i < sizeof suites / sizeof *suites; i++) {
+		if (argc < 2 || strcmp(argv[1], suites[i].name) == 0) {
+			suites[i].run();
+			ran++;
+		}
+	}
+	if (ran == 0) {
+		fprintf(stderr, "unknown benchmark suite: %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
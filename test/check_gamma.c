@@ -0,0 +1,148 @@
+/*
+ * Checks the gamma tables recorded by the mock compositor with -w. Every
+ * output must have received exactly the given temperatures in order, each as
+ * fill_gamma_table computes it, with a gamma of 1.0 unless given after a
+ * slash, as in 4000/2.2.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color_math.h"
+#include "mock_compositor.h"
+
+#define MAX_OUTPUTS 256
+
+struct expected {
+	int temp;
+	double gamma;
+};
+
+static int parse_expected(const char *str, struct expected *expected) {
+	char *end;
+	errno = 0;
+	long temp = strtol(str, &end, 10);
+	if (errno != 0 || end == str || temp < 1000 || temp > 25000) {
+		return -1;
+	}
+	expected->temp = temp;
+	expected->gamma = 1.0;
+	if (*end == '/') {
+		const char *gamma = end + 1;
+		expected->gamma = strtod(gamma, &end);
+		if (end == gamma || expected->gamma <= 0.0) {
+			return -1;
+		}
+	}
+	return *end == '\0' ? 0 : -1;
+}
+
+static bool check_table(const struct mock_record *record,
+		const uint16_t *table, const struct expected *expected) {
+	uint32_t n = record->ramp_size;
+	uint16_t *want = malloc(n * 3 * sizeof *want);
+	if (want == NULL) {
+		fprintf(stderr, "could not allocate table\n");
+		exit(EXIT_FAILURE);
+	}
+	double rw, gw, bw;
+	calc_whitepoint(expected->temp, &rw, &gw, &bw);
+	fill_gamma_table(want, n, rw, gw, bw, expected->gamma);
+
+	bool ok = true;
+	for (uint32_t i = 0; i < n * 3; i++) {
+		if (table[i] != want[i]) {
+			fprintf(stderr, "output %u: table for %d K differs at %c[%u]: "
+					"%u instead of %u\n", record->output,
+					expected->temp, "rgb"[i / n], i % n, table[i],
+					want[i]);
+			ok = false;
+			break;
+		}
+	}
+	free(want);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <record file> <temp>[/<gamma>]...\n",
+				argv[0]);
+		return EXIT_FAILURE;
+	}
+	size_t expected_len = argc - 2;
+	struct expected *expected = calloc(expected_len, sizeof *expected);
+	if (expected == NULL) {
+		fprintf(stderr, "could not allocate expected tables\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < expected_len; i++) {
+		if (parse_expected(argv[i + 2], &expected[i]) == -1) {
+			fprintf(stderr, "invalid temperature: %s\n", argv[i + 2]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	FILE *f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		fprintf(stderr, "could not open %s: %s\n", argv[1],
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// The number of tables each output received so far
+	size_t received[MAX_OUTPUTS] = { 0 };
+	bool ok = true;
+	struct mock_record record;
+	while (fread(&record, sizeof record, 1, f) == 1) {
+		if (record.output >= MAX_OUTPUTS || record.ramp_size < 2) {
+			fprintf(stderr, "invalid record for output %u\n",
+					record.output);
+			ok = false;
+			break;
+		}
+		size_t size = record.ramp_size * 3 * sizeof(uint16_t);
+		uint16_t *table = malloc(size);
+		if (table == NULL || fread(table, size, 1, f) != 1) {
+			fprintf(stderr, "truncated record for output %u\n",
+					record.output);
+			free(table);
+			ok = false;
+			break;
+		}
+
+		size_t index = received[record.output]++;
+		if (index >= expected_len) {
+			fprintf(stderr, "output %u: unexpected table %zu\n",
+					record.output, index + 1);
+			ok = false;
+		} else if (!check_table(&record, table, &expected[index])) {
+			ok = false;
+		}
+		free(table);
+	}
+	fclose(f);
+
+	size_t outputs = 0;
+	for (uint32_t i = 0; i < MAX_OUTPUTS; i++) {
+		if (received[i] == 0) {
+			continue;
+		}
+		outputs++;
+		printf("output %u: %zu tables\n", i, received[i]);
+		if (received[i] != expected_len) {
+			fprintf(stderr, "output %u: %zu tables instead of %zu\n",
+					i, received[i], expected_len);
+			ok = false;
+		}
+	}
+	if (outputs == 0) {
+		fprintf(stderr, "no tables recorded\n");
+		ok = false;
+	}
+	free(expected);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
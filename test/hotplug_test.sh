@@ -0,0 +1,91 @@
+#!/bin/sh
+# Adds and removes dozens of outputs in bursts through the commands of the
+# mock compositor, and checks that wlsunset sets up each burst in a single
+# commit round once the batching window (-w) has passed, computing one table
+# per distinct ramp size and sending one to each new output only. The
+# commands of a burst are spread over a part of the window, as outputs of a
+# dock coming up one after the other would be.
+#
+# usage: hotplug_test.sh <mock-compositor> <wlsunset>
+set -eu
+
+mock=$1
+wlsunset=$2
+. "$(dirname "$0")/mock_lib.sh"
+
+# The window is long enough to take in a burst of four groups of commands
+# spread apart, and a second round would show up within the settle time.
+window_ms=500
+spread=0.05
+settle=1
+
+# Keeping the pipe open read-write lets the mock open it without waiting
+mock_input=$dir/commands
+mkfifo "$mock_input"
+exec 3<>"$mock_input"
+start_mock -r 256
+start_wlsunset -w "$window_ms"
+wait_for wlsunset.log '^setting temperature' 1
+wait_for mock.log ' set_gamma ' 1
+
+rounds=1
+set_gammas=1
+
+# Sends each group of commands of a burst in one write, waits for wlsunset to
+# commit to the added outputs, and checks that it did so in a single round.
+burst() {
+	added=$1
+	shift
+	for group; do
+		printf '%s\n' "$group" >&3
+		sleep "$spread"
+	done
+	set_gammas=$((set_gammas + added))
+	wait_for mock.log ' set_gamma ' "$set_gammas"
+
+	sleep "$settle"
+	rounds=$((rounds + 1))
+	[ "$(count wlsunset.log '^setting temperature')" -eq "$rounds" ] ||
+		fail "$added outputs were not set up in a single round"
+	[ "$(count mock.log ' set_gamma ')" -eq "$set_gammas" ] ||
+		fail "outputs received more than one table each"
+
+	fills=$(grep '^setting temperature' "$dir/wlsunset.log" | tail -n 1 |
+		sed 's/.*(\([0-9]*\) tables computed.*/\1/')
+	[ "$fills" -eq 3 ] ||
+		fail "$fills tables computed for 3 ramp sizes"
+	echo "round $rounds: $added outputs, $fills tables computed"
+}
+
+# Adds outputs, cycling through three ramp sizes
+adds() {
+	i=0
+	while [ "$i" -lt "$1" ]; do
+		case $((i % 3)) in
+		0) echo "add 256" ;;
+		1) echo "add 1024" ;;
+		*) echo "add 4096" ;;
+		esac
+		i=$((i + 1))
+	done
+}
+
+# Removes a range of outputs
+removes() {
+	seq "$1" "$2" | sed 's/^/remove /'
+}
+
+# Outputs 1 to 40
+burst 40 "$(adds 10)" "$(adds 10)" "$(adds 10)" "$(adds 10)"
+
+# Outputs 1 to 20 go away while 41 to 60 appear
+burst 20 "$(removes 1 10)" "$(adds 10)" "$(removes 11 20)" "$(adds 10)"
+
+stop_wlsunset
+echo quit >&3
+wait "$mock_pid" || fail "mock compositor exited with $?"
+mock_pid=
+
+for message in output gamma_control set_gamma failed released remove; do
+	printf '%s: %s\n' "$message" "$(count mock.log " $message ")"
+done
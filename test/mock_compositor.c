@@ -0,0 +1,532 @@
+/*
+ * A headless compositor that only implements wl_output and
+ * zwlr_gamma_control_manager_v1, so that wlsunset can be run and measured
+ * without a display.
+ *
+ * Every event is logged to stdout as a line starting with a monotonic timestamp
+ * in microseconds, followed by the event and the id of the output. Each
+ * set_gamma line also carries a sequence number and the ends of each ramp.
+ * With -w, every gamma table received is also appended to a file as a record
+ * of a struct mock_record followed by the red, green and blue ramps.
+ *
+ * Outputs can be added, removed and failed at runtime by writing commands to
+ * stdin, one per line:
+ *
+ *   add <ramp size>   announce a new output
+ *   remove <output>   remove an output, failing its gamma control
+ *   fail <output>     send failed to the gamma control of an output
+ *   quit              exit
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include "wlr-gamma-control-unstable-v1-server-protocol.h"
+#include "mock_compositor.h"
+
+struct gamma_control;
+
+struct output {
+	struct wl_list link;
+	uint32_t id;
+	uint32_t ramp_size;
+	struct wl_global *global;
+	struct wl_list resources;
+	struct gamma_control *gamma_control;
+};
+
+struct gamma_control {
+	struct wl_resource *resource;
+	struct output *output;
+};
+
+static struct wl_display *display = NULL;
+static struct wl_list outputs;
+static uint32_t next_output_id = 0;
+static FILE *record_file = NULL;
+static uint64_t set_gamma_count = 0;
+
+static uint64_t get_monotonic_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void log_event(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	printf("%llu ", (unsigned long long)get_monotonic_us());
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+	fflush(stdout);
+}
+
+static struct output *find_output(uint32_t id) {
+	struct output *output;
+	wl_list_for_each(output, &outputs, link) {
+		if (output->id == id) {
+			return output;
+		}
+	}
+	return NULL;
+}
+
+// The gamma control becomes inert, and the output can be controlled again
+static void gamma_control_fail(struct gamma_control *control) {
+	if (control->output == NULL) {
+		return;
+	}
+	log_event("failed %u", control->output->id);
+	zwlr_gamma_control_v1_send_failed(control->resource);
+	control->output->gamma_control = NULL;
+	control->output = NULL;
+}
+
+static int read_table(int fd, uint16_t *table, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = read(fd, (char *)table + done, size - done);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static void gamma_control_handle_set_gamma(struct wl_client *client,
+		struct wl_resource *resource, int32_t fd) {
+	(void)client;
+	struct gamma_control *control = wl_resource_get_user_data(resource);
+	struct output *output = control->output;
+	if (output == NULL) {
+		close(fd);
+		return;
+	}
+
+	uint64_t timestamp = get_monotonic_us();
+	size_t size = output->ramp_size * 3 * sizeof(uint16_t);
+	uint16_t *table = malloc(size);
+	if (table == NULL) {
+		close(fd);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+	if (read_table(fd, table, size) == -1) {
+		close(fd);
+		free(table);
+		wl_resource_post_error(resource,
+				ZWLR_GAMMA_CONTROL_V1_ERROR_INVALID_GAMMA,
+				"gamma table is shorter than 3 ramps of %u",
+				output->ramp_size);
+		return;
+	}
+	close(fd);
+
+	uint32_t n = output->ramp_size;
+	printf("%llu set_gamma %u %llu r=%u..%u g=%u..%u b=%u..%u\n",
+			(unsigned long long)timestamp, output->id,
+			(unsigned long long)set_gamma_count++,
+			table[0], table[n - 1],
+			table[n], table[2 * n - 1],
+			table[2 * n], table[3 * n - 1]);
+	fflush(stdout);
+
+	if (record_file != NULL) {
+		struct mock_record record = {
+			.timestamp_us = timestamp,
+			.output = output->id,
+			.ramp_size = output->ramp_size,
+		};
+		if (fwrite(&record, sizeof record, 1, record_file) != 1 ||
+				fwrite(table, size, 1, record_file) != 1 ||
+				fflush(record_file) != 0) {
+			fprintf(stderr, "could not record gamma table: %s\n",
+					strerror(errno));
+		}
+	}
+	free(table);
+}
+
+static void gamma_control_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_gamma_control_v1_interface gamma_control_impl = {
+	.set_gamma = gamma_control_handle_set_gamma,
+	.destroy = gamma_control_handle_destroy,
+};
+
+static void gamma_control_resource_destroy(struct wl_resource *resource) {
+	struct gamma_control *control = wl_resource_get_user_data(resource);
+	if (control->output != NULL) {
+		log_event("released %u", control->output->id);
+		control->output->gamma_control = NULL;
+	}
+	free(control);
+}
+
+static void manager_handle_get_gamma_control(struct wl_client *client,
+		struct wl_resource *manager_resource, uint32_t id,
+		struct wl_resource *output_resource) {
+	struct gamma_control *control = calloc(1, sizeof *control);
+	if (control == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	control->resource = wl_resource_create(client,
+			&zwlr_gamma_control_v1_interface,
+			wl_resource_get_version(manager_resource), id);
+	if (control->resource == NULL) {
+		free(control);
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(control->resource, &gamma_control_impl,
+			control, gamma_control_resource_destroy);
+
+	// Like wlroots, only one client at a time may control an output
+	struct output *output = wl_resource_get_user_data(output_resource);
+	if (output == NULL || output->gamma_control != NULL) {
+		log_event("failed %d", output != NULL ? (int)output->id : -1);
+		zwlr_gamma_control_v1_send_failed(control->resource);
+		return;
+	}
+
+	control->output = output;
+	output->gamma_control = control;
+	log_event("gamma_control %u", output->id);
+	zwlr_gamma_control_v1_send_gamma_size(control->resource,
+			output->ramp_size);
+}
+
+static void manager_handle_destroy(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct zwlr_gamma_control_manager_v1_interface manager_impl = {
+	.get_gamma_control = manager_handle_get_gamma_control,
+	.destroy = manager_handle_destroy,
+};
+
+static void manager_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	(void)data;
+	struct wl_resource *resource = wl_resource_create(client,
+			&zwlr_gamma_control_manager_v1_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &manager_impl, NULL, NULL);
+}
+
+static void output_handle_release(struct wl_client *client,
+		struct wl_resource *resource) {
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_impl = {
+	.release = output_handle_release,
+};
+
+static void output_resource_destroy(struct wl_resource *resource) {
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void output_bind(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id) {
+	struct output *output = data;
+	struct wl_resource *resource = wl_resource_create(client,
+			&wl_output_interface, version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &output_impl, output,
+			output_resource_destroy);
+	wl_list_insert(&output->resources, wl_resource_get_link(resource));
+
+	char model[32];
+	snprintf(model, sizeof model, "mock-%u", output->id);
+	wl_output_send_geometry(resource, 0, 0, 0, 0,
+			WL_OUTPUT_SUBPIXEL_UNKNOWN, "wlsunset", model,
+			WL_OUTPUT_TRANSFORM_NORMAL);
+	wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT, 1920, 1080,
+			60000);
+	if (version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+		wl_output_send_scale(resource, 1);
+	}
+	if (version >= WL_OUTPUT_DONE_SINCE_VERSION) {
+		wl_output_send_done(resource);
+	}
+}
+
+static struct output *add_output(uint32_t ramp_size) {
+	struct output *output = calloc(1, sizeof *output);
+	if (output == NULL) {
+		return NULL;
+	}
+	output->id = next_output_id++;
+	output->ramp_size = ramp_size;
+	wl_list_init(&output->resources);
+	output->global = wl_global_create(display, &wl_output_interface, 3,
+			output, output_bind);
+	if (output->global == NULL) {
+		free(output);
+		return NULL;
+	}
+	wl_list_insert(outputs.prev, &output->link);
+	log_event("output %u %u", output->id, output->ramp_size);
+	return output;
+}
+
+static void remove_output(struct output *output) {
+	if (output->gamma_control != NULL) {
+		gamma_control_fail(output->gamma_control);
+	}
+
+	// Requests on outputs that are still bound now refer to no output
+	struct wl_resource *resource, *tmp;
+	wl_resource_for_each_safe(resource, tmp, &output->resources) {
+		wl_resource_set_user_data(resource, NULL);
+		wl_list_remove(wl_resource_get_link(resource));
+		wl_list_init(wl_resource_get_link(resource));
+	}
+
+	log_event("remove %u", output->id);
+	wl_global_destroy(output->global);
+	wl_list_remove(&output->link);
+	free(output);
+}
+
+static int parse_ramp_size(const char *str, uint32_t *ramp_size) {
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || value < 2 ||
+			value > UINT16_MAX + 1) {
+		return -1;
+	}
+	*ramp_size = value;
+	return 0;
+}
+
+static void handle_command(char *line) {
+	char *cmd = strtok(line, " \t");
+	char *arg = strtok(NULL, " \t");
+	if (cmd == NULL) {
+		return;
+	}
+
+	if (strcmp(cmd, "quit") == 0) {
+		wl_display_terminate(display);
+		return;
+	}
+	if (arg == NULL) {
+		fprintf(stderr, "%s: missing argument\n", cmd);
+		return;
+	}
+
+	if (strcmp(cmd, "add") == 0) {
+		uint32_t ramp_size;
+		if (parse_ramp_size(arg, &ramp_size) == -1) {
+			fprintf(stderr, "add: invalid ramp size: %s\n", arg);
+		} else if (add_output(ramp_size) == NULL) {
+			fprintf(stderr, "add: could not create output\n");
+		}
+		return;
+	}
+
+	struct output *output = find_output(strtoul(arg, NULL, 10));
+	if (output == NULL) {
+		fprintf(stderr, "%s: no such output: %s\n", cmd, arg);
+	} else if (strcmp(cmd, "remove") == 0) {
+		remove_output(output);
+	} else if (strcmp(cmd, "fail") == 0) {
+		if (output->gamma_control == NULL) {
+			fprintf(stderr, "fail: output %s has no gamma control\n",
+					arg);
+		} else {
+			gamma_control_fail(output->gamma_control);
+		}
+	} else {
+		fprintf(stderr, "unknown command: %s\n", cmd);
+	}
+}
+
+static char command_buf[256];
+static size_t command_len = 0;
+
+static int handle_stdin(int fd, uint32_t mask, void *data) {
+	struct wl_event_source **source = data;
+	ssize_t n = 0;
+	if (mask & WL_EVENT_READABLE) {
+		n = read(fd, command_buf + command_len,
+				sizeof command_buf - command_len - 1);
+		if (n == -1 && errno == EINTR) {
+			return 0;
+		}
+	}
+	if (n <= 0) {
+		// Without commands, keep serving until terminated
+		wl_event_source_remove(*source);
+		*source = NULL;
+		return 0;
+	}
+	command_len += n;
+	command_buf[command_len] = '\0';
+
+	char *line = command_buf;
+	char *newline;
+	while ((newline = strchr(line, '\n')) != NULL) {
+		*newline = '\0';
+		handle_command(line);
+		line = newline + 1;
+	}
+	command_len -= line - command_buf;
+	memmove(command_buf, line, command_len);
+	if (command_len == sizeof command_buf - 1) {
+		fprintf(stderr, "command too long\n");
+		command_len = 0;
+	}
+	return 0;
+}
+
+static int handle_signal(int signal, void *data) {
+	(void)signal;
+	(void)data;
+	wl_display_terminate(display);
+	return 0;
+}
+
+static const char usage[] = "usage: %s [options]\n"
+"  -h            show this help message\n"
+"  -r <size>     add an output with the given ramp size, can be repeated\n"
+"                (default: one output of 256)\n"
+"  -s <name>     listen on the given socket name instead of the first free\n"
+"  -w <file>     append every gamma table received to a file\n";
+
+int main(int argc, char *argv[]) {
+	uint32_t ramp_sizes[64];
+	size_t ramp_sizes_len = 0;
+	const char *socket_name = NULL;
+	const char *record_path = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hr:s:w:")) != -1) {
+		switch (opt) {
+		case 'r':
+			if (ramp_sizes_len == sizeof ramp_sizes / sizeof *ramp_sizes) {
+				fprintf(stderr, "too many outputs\n");
+				return EXIT_FAILURE;
+			}
+			if (parse_ramp_size(optarg, &ramp_sizes[ramp_sizes_len]) == -1) {
+				fprintf(stderr, "invalid ramp size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			ramp_sizes_len++;
+			break;
+		case 's':
+			socket_name = optarg;
+			break;
+		case 'w':
+			record_path = optarg;
+			break;
+		case 'h':
+		default:
+			fprintf(stderr, usage, argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (ramp_sizes_len == 0) {
+		ramp_sizes[ramp_sizes_len++] = 256;
+	}
+
+	if (record_path != NULL) {
+		record_file = fopen(record_path, "ab");
+		if (record_file == NULL) {
+			fprintf(stderr, "could not open %s: %s\n", record_path,
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Clients going away mid-write must not take us with them
+	signal(SIGPIPE, SIG_IGN);
+
+	int ret = EXIT_FAILURE;
+	display = wl_display_create();
+	if (display == NULL) {
+		fprintf(stderr, "could not create display\n");
+		goto out;
+	}
+	wl_list_init(&outputs);
+
+	if (socket_name != NULL) {
+		if (wl_display_add_socket(display, socket_name) == -1) {
+			fprintf(stderr, "could not listen on %s\n", socket_name);
+			goto out;
+		}
+	} else {
+		socket_name = wl_display_add_socket_auto(display);
+		if (socket_name == NULL) {
+			fprintf(stderr, "could not create socket\n");
+			goto out;
+		}
+	}
+
+	if (wl_global_create(display, &zwlr_gamma_control_manager_v1_interface,
+				1, NULL, manager_bind) == NULL) {
+		fprintf(stderr, "could not create gamma control manager\n");
+		goto out;
+	}
+	for (size_t i = 0; i < ramp_sizes_len; i++) {
+		if (add_output(ramp_sizes[i]) == NULL) {
+			fprintf(stderr, "could not create output\n");
+			goto out;
+		}
+	}
+
+	struct wl_event_loop *loop = wl_display_get_event_loop(display);
+	struct wl_event_source *stdin_source = NULL;
+	stdin_source = wl_event_loop_add_fd(loop, STDIN_FILENO,
+			WL_EVENT_READABLE, handle_stdin, &stdin_source);
+	wl_event_loop_add_signal(loop, SIGINT, handle_signal, NULL);
+	wl_event_loop_add_signal(loop, SIGTERM, handle_signal, NULL);
+
+	log_event("listening %s", socket_name);
+	wl_display_run(display);
+	ret = EXIT_SUCCESS;
+
+out:
+	if (display != NULL) {
+		wl_display_destroy_clients(display);
+		struct output *output, *tmp;
+		wl_list_for_each_safe(output, tmp, &outputs, link) {
+			remove_output(output);
+		}
+		wl_display_destroy(display);
+	}
+	if (record_file != NULL) {
+		fclose(record_file);
+	}
+	return ret;
+}
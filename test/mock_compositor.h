@@ -0,0 +1,16 @@
+#ifndef _MOCK_COMPOSITOR_H
+#define _MOCK_COMPOSITOR_H
+
+#include <stdint.h>
+
+/*
+ * The header of each gamma table recorded by the mock compositor with -w. It
+ * is followed by the red, green and blue ramps of ramp_size entries each.
+ */
+struct mock_record {
+	uint64_t timestamp_us;
+	uint32_t output;
+	uint32_t ramp_size;
+};
+
+#endif
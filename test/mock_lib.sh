@@ -0,0 +1,69 @@
+# Shared by the tests that run wlsunset against the mock compositor, which
+# source it after setting mock and wlsunset to the paths of both.
+
+dir=$(mktemp -d)
+mock_pid=
+wlsunset_pid=
+cleanup() {
+	[ -n "$wlsunset_pid" ] && kill "$wlsunset_pid" 2>/dev/null
+	[ -n "$mock_pid" ] && kill "$mock_pid" 2>/dev/null
+	wait
+	rm -rf "$dir"
+}
+trap cleanup EXIT
+
+export XDG_RUNTIME_DIR=$dir
+export WAYLAND_DISPLAY=wayland-mock
+export TZ=UTC
+touch "$dir/mock.log" "$dir/wlsunset.log"
+
+fail() {
+	echo "$*" >&2
+	echo "--- mock compositor" >&2
+	cat "$dir/mock.log" >&2
+	echo "--- wlsunset" >&2
+	cat "$dir/wlsunset.log" >&2
+	exit 1
+}
+
+# Prints the number of lines of a log in $dir matching a pattern
+count() {
+	grep -c "$2" "$dir/$1" || true
+}
+
+# Waits up to 5 seconds for a log in $dir to have a number of lines matching
+# a pattern
+wait_for() {
+	for _ in $(seq 50); do
+		if [ "$(count "$1" "$2")" -ge "$3" ]; then
+			return 0
+		fi
+		sleep 0.1
+	done
+	fail "timed out waiting for $3 lines of '$2' in $1"
+}
+
+# Starts the mock compositor, reading commands from mock_input
+mock_input=/dev/null
+start_mock() {
+	"$mock" -s "$WAYLAND_DISPLAY" "$@" <"$mock_input" >"$dir/mock.log" 2>&1 &
+	mock_pid=$!
+	wait_for mock.log ' listening ' 1
+}
+
+# Sunrise two hours from now puts the start of the run in the night, at the
+# low temperature, far from any transition.
+start_wlsunset() {
+	sunrise=$(( ($(date +%H | sed 's/^0//') + 2) % 24 ))
+	"$wlsunset" -S "$sunrise:00" -s "$sunrise:30" -d 60 -t 4000 -T 6500 \
+		"$@" >"$dir/wlsunset.log" 2>&1 &
+	wlsunset_pid=$!
+}
+
+stop_wlsunset() {
+	kill "$wlsunset_pid"
+	status=0
+	wait "$wlsunset_pid" || status=$?
+	wlsunset_pid=
+	[ "$status" -eq 0 ] || fail "wlsunset exited with $status"
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Runs wlsunset against the mock compositor with two outputs, forces a few
+# temperatures and a gamma through the control socket, and checks that every
+# output received exactly those gamma tables.
+#
+# usage: mock_test.sh <mock-compositor> <wlsunset> <check_gamma>
+set -eu
+
+mock=$1
+wlsunset=$2
+check_gamma=$3
+. "$(dirname "$0")/mock_lib.sh"
+
+start_mock -r 256 -r 1024 -w "$dir/gamma.bin"
+start_wlsunset -c
+wait_for mock.log ' set_gamma ' 2
+
+"$wlsunset" -C "force 2500" >/dev/null || fail "force 2500 was rejected"
+wait_for mock.log ' set_gamma ' 4
+"$wlsunset" -C "force 9000" >/dev/null || fail "force 9000 was rejected"
+wait_for mock.log ' set_gamma ' 6
+"$wlsunset" -C "set gamma 2.2" >/dev/null || fail "set gamma was rejected"
+wait_for mock.log ' set_gamma ' 8
+
+stop_wlsunset
+wait_for mock.log ' released ' 2
+
+"$check_gamma" "$dir/gamma.bin" 4000 2500 9000 9000/2.2 ||
+	fail "unexpected gamma tables"
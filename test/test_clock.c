@@ -0,0 +1,147 @@
+/*
+ * Checks that the schedule follows the realtime clock being set. The clock and
+ * the schedule timer are simulated: the realtime clock is a variable that the
+ * test moves, and reading the timer fails with ECANCELED as a timerfd with
+ * TFD_TIMER_CANCEL_ON_SET does once the clock was set.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct timespec fake_realtime;
+static time_t armed_deadline;
+static int fake_timer_fd = -1;
+static int pending_cancels = 0;
+
+static int fake_clock_gettime(clockid_t clock, struct timespec *ts) {
+	if (clock == CLOCK_REALTIME) {
+		*ts = fake_realtime;
+		return 0;
+	}
+	return (clock_gettime)(clock, ts);
+}
+
+static ssize_t fake_read(int fd, void *buf, size_t count) {
+	if (fd != fake_timer_fd) {
+		return (read)(fd, buf, count);
+	}
+	if (pending_cancels == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	pending_cancels--;
+	errno = ECANCELED;
+	return -1;
+}
+
+static int fake_timerfd_settime(int fd, int flags,
+		const struct itimerspec *new_value, struct itimerspec *old_value) {
+	(void)fd;
+	(void)flags;
+	(void)old_value;
+	armed_deadline = new_value->it_value.tv_sec;
+	return 0;
+}
+
+#define clock_gettime(clock, ts) fake_clock_gettime(clock, ts)
+#define read(fd, buf, count) fake_read(fd, buf, count)
+#define timerfd_settime(fd, flags, new_value, old_value) \
+	fake_timerfd_settime(fd, flags, new_value, old_value)
+
+#define main wlsunset_main
+int main(int argc, char *argv[]);
+#include "main.c"
+#undef main
+
+// Re-evaluating the schedule should take well under a frame, not wait for
+// the next deadline
+#define MAX_LATENCY_US 50000
+
+static int failures = 0;
+
+#define check(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Sets the simulated clock, wakes the timer as the kernel would, and checks
+ * that the temperature of the new time is committed within the bound.
+ */
+static void set_clock(struct context *ctx, struct schedule_step *step,
+		time_t *deadline, time_t now, int temp) {
+	fake_realtime.tv_sec = now;
+	pending_cancels++;
+
+	double start = get_monotonic_us();
+	if (read_timer(ctx) == -1 || !ctx->timer_fired) {
+		check(false, "timer did not fire when the clock was set");
+		return;
+	}
+	ctx->timer_fired = false;
+	handle_timer(ctx, step, deadline);
+	double latency = get_monotonic_us() - start;
+
+	printf("clock set to %lld, temperature %d after %.0fus\n",
+			(long long)now, ctx->committed_temp, latency);
+	check(ctx->committed_temp == temp, "temperature %d instead of %d",
+			ctx->committed_temp, temp);
+	check(armed_deadline == *deadline && *deadline > now,
+			"timer armed for %lld, not after %lld",
+			(long long)armed_deadline, (long long)now);
+	check(latency <= MAX_LATENCY_US, "latency above %dus", MAX_LATENCY_US);
+}
+
+int main(void) {
+	// Noon in Berlin on the June solstice of 2021
+	const time_t noon = 1624269600;
+	fake_realtime.tv_sec = noon;
+
+	struct config cfg = {
+		.latitude = RADIANS(52.5),
+		.longitude = RADIANS(13.4),
+		.high_temp = 6500,
+		.low_temp = 4000,
+		.gamma = 1.0,
+	};
+	struct context ctx;
+	init_context(&ctx, cfg);
+	ctx.timer_fd = fake_timer_fd = 100;
+
+	time_t now = get_time_sec();
+	recalc_stops(&ctx, now);
+	struct schedule_step step = *get_step(&ctx, now);
+	set_temperature(&ctx, &step, false);
+	time_t deadline = get_wakeup(&ctx, now);
+	update_timer(ctx.timer_fd, deadline);
+	check(ctx.committed_temp == 6500, "temperature %d at noon",
+			ctx.committed_temp);
+
+	check(read_timer(&ctx) == 0 && !ctx.timer_fired,
+			"timer fired before its deadline");
+
+	// Forward to the night, within the same day
+	set_clock(&ctx, &step, &deadline, noon + 11 * 3600, 4000);
+
+	// Forward to noon of the next day, which needs new stops
+	time_t day = ctx.calc_day;
+	set_clock(&ctx, &step, &deadline, noon + 86400, 6500);
+	check(ctx.calc_day == day + 86400, "stops not recalculated");
+
+	// Back to the night before
+	set_clock(&ctx, &step, &deadline, noon + 11 * 3600, 4000);
+	check(ctx.calc_day == day, "stops not recalculated");
+
+	free(ctx.schedule);
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/*
+ * color_math.c is included rather than linked, so that its internals can be
+ * checked against the public functions built on them.
+ */
+#include "color_math.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define check(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// fill_gamma_table as it was before the whitepoint was factored out
+static void fill_gamma_table_reference(uint16_t *table, uint32_t ramp_size,
+		double rw, double gw, double bw, double gamma) {
+	uint16_t *r = table;
+	uint16_t *g = table + ramp_size;
+	uint16_t *b = table + 2 * ramp_size;
+	for (uint32_t i = 0; i < ramp_size; ++i) {
+		double val = (double)i / (ramp_size - 1);
+		r[i] = (uint16_t)(UINT16_MAX * pow(val * rw, 1.0 / gamma));
+		g[i] = (uint16_t)(UINT16_MAX * pow(val * gw, 1.0 / gamma));
+		b[i] = (uint16_t)(UINT16_MAX * pow(val * bw, 1.0 / gamma));
+	}
+}
+
+static void test_fill_gamma_table(void) {
+	const uint32_t sizes[] = { 2, 50, 256, 1024, 4096, 65536 };
+	const double gammas[] = { 1.0, 0.8, 1.5, 2.2 };
+
+	for (size_t s = 0; s < sizeof sizes / sizeof *sizes; s++) {
+		uint32_t size = sizes[s];
+		uint16_t *table = malloc(size * 3 * sizeof *table);
+		uint16_t *reference = malloc(size * 3 * sizeof *reference);
+		if (table == NULL || reference == NULL) {
+			abort();
+		}
+
+		for (size_t n = 0; n < sizeof gammas / sizeof *gammas; n++) {
+			double gamma = gammas[n];
+			int max_error = 0;
+			for (int temp = 1000; temp <= 25000; temp += 500) {
+				double rw, gw, bw;
+				calc_whitepoint(temp, &rw, &gw, &bw);
+				fill_gamma_table(table, size, rw, gw, bw, gamma);
+				fill_gamma_table_reference(reference, size, rw, gw,
+						bw, gamma);
+				for (uint32_t i = 0; i < size * 3; i++) {
+					int error = abs(table[i] - reference[i]);
+					if (error > max_error) {
+						max_error = error;
+					}
+				}
+			}
+
+			// Without pow() there is nothing to round differently
+			check(max_error <= (gamma == 1.0 ? 0 : 1),
+					"ramp size %u, gamma %.1f: off by %d",
+					size, gamma, max_error);
+
+			fill_gamma_table(table, size, 1.0, 1.0, 1.0, gamma);
+			check(table[size - 1] == UINT16_MAX &&
+					table[2 * size - 1] == UINT16_MAX &&
+					table[3 * size - 1] == UINT16_MAX,
+					"ramp size %u, gamma %.1f: white is not full scale",
+					size, gamma);
+		}
+
+		free(table);
+		free(reference);
+	}
+}
+
+static void test_whitepoint_table(void) {
+	double max_error = 0.0;
+	double max_temp = 0.0;
+
+	// Tenths of a kelvin, so that points between table entries are covered
+	for (int tenths = 10000; tenths <= 250000; tenths++) {
+		double temp = tenths / 10.0;
+		double rw, gw, bw, re, ge, be;
+		calc_whitepoint(temp, &rw, &gw, &bw);
+		calc_whitepoint_exact(temp, &re, &ge, &be);
+		// Channels are relative to full scale, and blue reaches 0
+		double errors[] = { fabs(rw - re), fabs(gw - ge), fabs(bw - be) };
+		for (int c = 0; c < 3; c++) {
+			if (errors[c] > max_error) {
+				max_error = errors[c];
+				max_temp = temp;
+			}
+		}
+	}
+	check(max_error < 0.001, "whitepoint off by %.6f at %.1fK",
+			max_error, max_temp);
+
+	// Outside the table the ends are held
+	double rw, gw, bw, re, ge, be;
+	calc_whitepoint(500, &rw, &gw, &bw);
+	calc_whitepoint_exact(1000, &re, &ge, &be);
+	check(rw == (float)re && gw == (float)ge && bw == (float)be,
+			"whitepoint below the table is not clamped");
+	calc_whitepoint(40000, &rw, &gw, &bw);
+	calc_whitepoint_exact(25000, &re, &ge, &be);
+	check(rw == (float)re && gw == (float)ge && bw == (float)be,
+			"whitepoint above the table is not clamped");
+
+	calc_whitepoint(6500, &rw, &gw, &bw);
+	check(rw == 1.0 && gw == 1.0 && bw == 1.0, "6500K is not neutral");
+}
+
+/*
+ * Sunrise and sunset in minutes after midnight UTC, as published by NOAA and
+ * timeanddate.com. Those use the standard zenith of 90.833 degrees and round
+ * to the minute.
+ */
+static const struct {
+	const char *name;
+	double latitude, longitude;
+	int year, yday;
+	int sunrise, sunset;
+} sun_references[] = {
+	{ "Berlin, June solstice", 52.52, 13.405, 2021, 171, 163, 1173 },
+	{ "Berlin, December solstice", 52.52, 13.405, 2021, 354, 435, 894 },
+	{ "London, June solstice", 51.5074, -0.1278, 2021, 171, 223, 1221 },
+	{ "New York, June solstice", 40.7128, -74.006, 2021, 171, 565, 1471 },
+	{ "Sydney, June solstice", -33.8688, 151.2093, 2021, 171, -180, 414 },
+	{ "Reykjavik, June solstice", 64.1466, -21.9426, 2021, 171, 175, 1443 },
+	{ "Reykjavik, December solstice", 64.1466, -21.9426, 2021, 354, 682, 929 },
+};
+
+#define SUN_TOLERANCE_MINUTES 2.0
+
+// The fast model takes the position of the sun once per day from a low order
+// series, while it moves on during the hours between noon and the event. At
+// Reykjavik, that puts sunrise and sunset up to 3 minutes off.
+#define SUN_FAST_TOLERANCE_MINUTES 4.0
+
+static void test_sun_times(void) {
+	check(fabs(COS_SOLAR_START_TWILIGHT - cos(RADIANS(90.833 + 6.0))) < 1e-15 &&
+			fabs(COS_SOLAR_END_TWILIGHT - cos(RADIANS(90.833 - 3.0))) < 1e-15,
+			"twilight cosines do not match their zenith angles");
+
+	for (size_t i = 0; i < sizeof sun_references / sizeof *sun_references; i++) {
+		struct tm tm = {
+			.tm_year = sun_references[i].year - 1900,
+			.tm_yday = sun_references[i].yday,
+		};
+		time_t midnight = lround((julian_day(&tm) - 2440587.5) * 86400);
+
+		// The day of the site starts at its local solar midnight
+		time_t offset = lround(sun_references[i].longitude * 240);
+		time_t start = midnight - offset;
+		gmtime_r(&start, &tm);
+
+		struct sun_day day;
+		struct sun_site site;
+		calc_sun_day(&tm, SUN_MODEL_PRECISE, &day);
+		calc_sun_site(RADIANS(sun_references[i].latitude), &site);
+
+		double cos_zenith = cos(RADIANS(90.833));
+		double sunrise = (precise_event_time(&day, &site, cos_zenith, true) -
+			offset) / 60.0;
+		double sunset = (precise_event_time(&day, &site, cos_zenith, false) -
+			offset) / 60.0;
+		check(fabs(sunrise - sun_references[i].sunrise) <= SUN_TOLERANCE_MINUTES,
+				"%s: sunrise off by %.1f minutes",
+				sun_references[i].name,
+				sunrise - sun_references[i].sunrise);
+		check(fabs(sunset - sun_references[i].sunset) <= SUN_TOLERANCE_MINUTES,
+				"%s: sunset off by %.1f minutes",
+				sun_references[i].name,
+				sunset - sun_references[i].sunset);
+
+		calc_sun_day(&tm, SUN_MODEL_FAST, &day);
+		double hour_angle = fabs(sun_hour_angle(&day, &site, cos_zenith));
+		sunrise = (hour_angle_to_time(hour_angle, day.eqtime) - offset) / 60.0;
+		sunset = (hour_angle_to_time(-hour_angle, day.eqtime) - offset) / 60.0;
+		check(fabs(sunrise - sun_references[i].sunrise) <= SUN_FAST_TOLERANCE_MINUTES,
+				"%s: fast sunrise off by %.1f minutes",
+				sun_references[i].name,
+				sunrise - sun_references[i].sunrise);
+		check(fabs(sunset - sun_references[i].sunset) <= SUN_FAST_TOLERANCE_MINUTES,
+				"%s: fast sunset off by %.1f minutes",
+				sun_references[i].name,
+				sunset - sun_references[i].sunset);
+	}
+
+	// Tromso has midnight sun in June, and polar night in December
+	struct sun_site site;
+	calc_sun_site(RADIANS(69.6492), &site);
+	struct tm june = { .tm_year = 121, .tm_yday = 171 };
+	struct tm december = { .tm_year = 121, .tm_yday = 354 };
+	for (int model = SUN_MODEL_FAST; model <= SUN_MODEL_PRECISE; model++) {
+		struct sun_day day;
+		struct sun sun;
+		calc_sun_day(&june, model, &day);
+		check(calc_sun_at(&day, &site, &sun) == MIDNIGHT_SUN,
+				"Tromso, June solstice: no midnight sun");
+		calc_sun_day(&december, model, &day);
+		check(calc_sun_at(&day, &site, &sun) == POLAR_NIGHT,
+				"Tromso, December solstice: no polar night");
+	}
+}
+
+int main(void) {
+	test_fill_gamma_table();
+	test_whitepoint_table();
+	test_sun_times();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
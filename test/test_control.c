@@ -0,0 +1,110 @@
+/*
+ * Feeds batches of control commands to a context that has not been through
+ * the main loop between them, as happens when a client sends several lines in
+ * one write.
+ */
+#define main wlsunset_main
+int main(int argc, char *argv[]);
+#include "main.c"
+#undef main
+
+static int failures = 0;
+
+#define check(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Runs each command of a batch and returns everything replied, to be freed
+static char *run_batch(struct context *ctx, const char *const *cmds) {
+	char *reply = NULL;
+	size_t reply_len = 0;
+	FILE *f = open_memstream(&reply, &reply_len);
+	if (f == NULL) {
+		perror("open_memstream");
+		exit(EXIT_FAILURE);
+	}
+	for (; *cmds != NULL; cmds++) {
+		char line[128];
+		snprintf(line, sizeof line, "%s", *cmds);
+		handle_control(ctx, line, f);
+	}
+	fclose(f);
+	return reply;
+}
+
+static void init_test_context(struct context *ctx) {
+	struct config cfg = {
+		.latitude = RADIANS(52.5),
+		.longitude = RADIANS(13.4),
+		.high_temp = 6500,
+		.low_temp = 4000,
+		.gamma = 1.0,
+	};
+	init_context(ctx, cfg);
+	recalc_stops(ctx, get_time_sec());
+}
+
+static void test_set_then_status(void) {
+	struct context ctx;
+	init_test_context(&ctx);
+
+	const char *const cmds[] = { "set latitude 60", "status", NULL };
+	char *reply = run_batch(&ctx, cmds);
+	check(strncmp(reply, "ok\nok\ntemperature ", 18) == 0,
+			"unexpected reply to set and status:\n%s", reply);
+	check(strstr(reply, "\nsun normal\n") != NULL,
+			"status does not report the recalculated sun:\n%s", reply);
+	free(reply);
+	free(ctx.schedule);
+}
+
+static void test_set_then_schedule(void) {
+	struct context ctx;
+	init_test_context(&ctx);
+
+	const char *const cmds[] = { "set longitude -100", "schedule 1", NULL };
+	char *reply = run_batch(&ctx, cmds);
+	long long time;
+	int temp;
+	check(sscanf(reply, "ok\nok\n%lld %d\n", &time, &temp) == 2 &&
+			temp >= 4000 && temp <= 6500,
+			"unexpected reply to set and schedule:\n%s", reply);
+	free(reply);
+	free(ctx.schedule);
+}
+
+static void test_invalid_temp(void) {
+	struct context ctx;
+	init_test_context(&ctx);
+
+	const char *const cmds[] = { "set low 0", "set high 30000", "force 0",
+		"set low 3000", NULL };
+	char *reply = run_batch(&ctx, cmds);
+	check(strcmp(reply, "error: temperature must be between 1000 and 25000\n"
+				"error: temperature must be between 1000 and 25000\n"
+				"error: temperature must be between 1000 and 25000\n"
+				"ok\n") == 0,
+			"unexpected reply to temperatures:\n%s", reply);
+	check(ctx.config.low_temp == 3000 && ctx.config.high_temp == 6500,
+			"temperatures are %d and %d", ctx.config.low_temp,
+			ctx.config.high_temp);
+	free(reply);
+	free(ctx.schedule);
+}
+
+int main(void) {
+	test_set_then_status();
+	test_set_then_schedule();
+	test_invalid_temp();
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}